@@ -0,0 +1,285 @@
+#pragma once
+
+#include <client.hpp>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+/// Runs the commands described on the standard input one after another from a single process,
+/// over a single connection if the server supports it. Each description is a dictionary
+/// with the list "argv" and the optional byte strings "cwd" and "stdin", the path of the file
+/// read as the standard input of the command, /dev/null by default. For each command,
+/// a dictionary with its "exitcode", "stderr" and "stdout" is written to the standard output
+struct Batch : bencode::Streaming_deserializer
+{
+	struct Command
+	{
+		std::vector<std::string> argv_;
+		std::string cwd_;
+		std::string stdin_;
+	};
+	
+	std::deque<Command> commands_;
+	Command command_;
+	std::string key_;
+	bool in_command_ = false;
+	bool in_argv_ = false;
+	
+	void visit_dictionary_begin() override
+	{
+		if (in_command_)
+		{
+			throw std::runtime_error(std::string("unexpected start of dictionary in a command"));
+		}
+		
+		in_command_ = true;
+		command_ = Command();
+	}
+	
+	void visit_dictionary_end() override
+	{
+		if (not key_.empty())
+		{
+			throw std::runtime_error(std::string("key '") + key_ + "' of a command has no value");
+		}
+		else if (command_.argv_.empty())
+		{
+			throw std::runtime_error(std::string("command without argv"));
+		}
+		
+		in_command_ = false;
+		commands_.push_back(std::move(command_));
+	}
+	
+	void visit_list_begin() override
+	{
+		if (not in_command_ or in_argv_ or key_ != "argv")
+		{
+			throw std::runtime_error(std::string("unexpected start of list"));
+		}
+		
+		in_argv_ = true;
+	}
+	
+	void visit_list_end() override
+	{
+		in_argv_ = false;
+		key_.clear();
+	}
+	
+	void visit_byte_string(std::string_view value) override
+	{
+		if (not in_command_)
+		{
+			throw std::runtime_error(std::string("command is not a dictionary"));
+		}
+		else if (in_argv_)
+		{
+			command_.argv_.emplace_back(value);
+		}
+		else if (key_.empty())
+		{
+			if (value != "argv" and value != "cwd" and value != "stdin")
+			{
+				throw std::runtime_error(std::string("key '") + std::string(value) + "' of a command is not valid");
+			}
+			
+			key_ = value;
+		}
+		else if (key_ == "cwd")
+		{
+			command_.cwd_ = value;
+			key_.clear();
+		}
+		else if (key_ == "stdin")
+		{
+			command_.stdin_ = value;
+			key_.clear();
+		}
+		else
+		{
+			throw std::runtime_error(std::string("expected a list for key 'argv'"));
+		}
+	}
+	
+	void visit_integer(bencode::Integer value) override
+	{
+		throw std::runtime_error(std::string("unexpected integer in a command, value: ") + std::to_string(value));
+	}
+	
+	using Descriptor = std::experimental::unique_resource<int, void(*)(int)>;
+	
+	static Descriptor duplicate(int fd, std::string_view name)
+	{
+		auto result = std::experimental::make_unique_resource_checked(fcntl(fd, F_DUPFD_CLOEXEC, 3), -1, &Client::checked_close);
+		
+		if (result.get() == -1)
+		{
+			throw std::runtime_error(std::string("failed to duplicate the ") + std::string(name) + ": " + std::strerror(errno));
+		}
+		
+		return result;
+	}
+	
+	static Descriptor create_output(const char* name)
+	{
+		auto result = std::experimental::make_unique_resource_checked(memfd_create(name, MFD_CLOEXEC), -1, &Client::checked_close);
+		
+		if (result.get() == -1)
+		{
+			throw std::runtime_error(std::string("failed to create a memory file: ") + std::strerror(errno));
+		}
+		
+		return result;
+	}
+	
+	static void replace(int fd, int target)
+	{
+		if (dup2(fd, target) == -1)
+		{
+			throw std::runtime_error(std::string("failed to replace file descriptor ") + std::to_string(target) + ": " + std::strerror(errno));
+		}
+	}
+	
+	/// @return The content of the memory file which was the output of the command, the file is emptied
+	static std::string take_output(int fd)
+	{
+		auto result = std::string();
+		auto size = lseek(fd, 0, SEEK_CUR);
+		
+		if (size == -1)
+		{
+			throw std::runtime_error(std::string("failed to inspect the output of the command: ") + std::strerror(errno));
+		}
+		
+		result.resize_and_overwrite(size, [fd](char* data, std::size_t size) -> std::size_t
+		{
+			auto read_bytes = pread(fd, data, size, 0);
+			return read_bytes == -1 ? 0 : read_bytes;
+		});
+		
+		if (ftruncate(fd, 0) or lseek(fd, 0, SEEK_SET) == -1)
+		{
+			throw std::runtime_error(std::string("failed to empty the output of the command: ") + std::strerror(errno));
+		}
+		
+		return result;
+	}
+	
+	static void write_all(int fd, std::string_view data)
+	{
+		while (not data.empty())
+		{
+			if (auto result = write(fd, data.data(), data.size()); result != -1)
+			{
+				data.remove_prefix(result);
+			}
+			else if (errno != EINTR)
+			{
+				throw std::runtime_error(std::string("failed to write the result of a command: ") + std::strerror(errno));
+			}
+		}
+	}
+	
+	int run()
+	{
+		// the standard streams of the batch are replaced by the streams of the commands
+		auto commands = duplicate(0, "standard input stream");
+		auto results = duplicate(1, "standard output stream");
+		auto errors = duplicate(2, "standard error stream");
+		auto directory = std::experimental::make_unique_resource_checked(open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC), -1, &Client::checked_close);
+		
+		if (directory.get() == -1)
+		{
+			throw std::runtime_error(std::string("failed to open the current working directory: ") + std::strerror(errno));
+		}
+		
+		auto restore_errors = std::experimental::unique_resource(errors.get(), +[](int fd) -> void
+		{
+			dup2(fd, 2);
+		});
+		
+		auto stdout_file = create_output("stdout");
+		auto stderr_file = create_output("stderr");
+		replace(stdout_file.get(), 1);
+		replace(stderr_file.get(), 2);
+		
+		auto connection = Client::Batch_connection();
+		// the commands inherit the environment of the batch
+		auto environment = Client::process_environment();
+		auto result = bencode::Serializer::create();
+		auto buffer = std::array<char, 64 * 1024>();
+		
+		while (true)
+		{
+			if (commands_.empty())
+			{
+				auto read_bytes = read(commands.get(), buffer.data(), buffer.size());
+				
+				if (read_bytes == -1 and errno == EINTR)
+				{
+					continue;
+				}
+				else if (read_bytes == -1)
+				{
+					throw std::runtime_error(std::string("failed to read the commands: ") + std::strerror(errno));
+				}
+				else if (read_bytes == 0)
+				{
+					if (not finished())
+					{
+						throw std::runtime_error(std::string("incomplete command at the end of the input"));
+					}
+					
+					return 0;
+				}
+				
+				receive(std::string_view(buffer.data(), read_bytes));
+				continue;
+			}
+			
+			auto command = std::move(commands_.front());
+			commands_.pop_front();
+			
+			if (not command.cwd_.empty() and chdir(command.cwd_.c_str()))
+			{
+				throw std::runtime_error(std::string("failed to change the working directory to ") + command.cwd_ + ": " + std::strerror(errno));
+			}
+			
+			{
+				auto input_path = command.stdin_.empty() ? "/dev/null" : command.stdin_.c_str();
+				auto input = std::experimental::make_unique_resource_checked(open(input_path, O_RDONLY | O_CLOEXEC), -1, &Client::checked_close);
+				
+				if (input.get() == -1)
+				{
+					throw std::runtime_error(std::string("failed to open the standard input file ") + input_path + ": " + std::strerror(errno));
+				}
+				
+				replace(input.get(), 0);
+			}
+			
+			auto argv = std::vector<std::string_view>(command.argv_.begin(), command.argv_.end());
+			auto cwd = Client::current_directory();
+			auto request = daiyousei::Request {.argv_ = argv, .environment_ = environment, .cwd_ = cwd};
+			auto exitcode = Client(request, &connection).run();
+			
+			if (fchdir(directory.get()))
+			{
+				throw std::runtime_error(std::string("failed to return to the original working directory: ") + std::strerror(errno));
+			}
+			
+			{
+				auto dictionary = result.push_dictionary();
+				dictionary.push_raw_data("8:exitcode");
+				dictionary.push_integer(exitcode);
+				dictionary.push_raw_data("6:stderr");
+				dictionary.push_byte_string(take_output(2));
+				dictionary.push_raw_data("6:stdout");
+				dictionary.push_byte_string(take_output(1));
+			}
+			
+			write_all(results.get(), result.take());
+		}
+	}
+};
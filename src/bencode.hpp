@@ -10,6 +10,7 @@
 #include <string>
 #include <string_view>
 #include <span>
+#include <optional>
 #include <variant>
 #include <expected>
 #include <vector>
@@ -126,7 +127,7 @@ struct serializable::Field
 	Serializable value;
 };
 
-void serializable::sort_dictionary(std::span<Field> value) noexcept
+inline void serializable::sort_dictionary(std::span<Field> value) noexcept
 {
 	std::ranges::sort(value, [](auto lhs, auto rhs) noexcept -> bool
 	{
@@ -134,12 +135,12 @@ void serializable::sort_dictionary(std::span<Field> value) noexcept
 	}, [](const auto& value) noexcept -> std::string_view {return value.name;});
 }
 
-serializable::Sorted_dictionary::Sorted_dictionary(Dictionary value) noexcept : Dictionary(std::move(value))
+inline serializable::Sorted_dictionary::Sorted_dictionary(Dictionary value) noexcept : Dictionary(std::move(value))
 {
 	sort_dictionary(static_cast<Dictionary&>(*this));
 }
 
-void serialize(std::string& output, serializable::Integer value)
+inline void serialize(std::string& output, serializable::Integer value)
 {
 	auto prev_size = output.size();
 	output.resize(prev_size + bencode::max_integer_length);
@@ -184,12 +185,12 @@ inline void serialize(std::string& output, const char* value)
 	return serialize(output, std::string_view(value));
 }
 
-void serialize(std::string& output, const serializable::Byte_string& value)
+inline void serialize(std::string& output, const serializable::Byte_string& value)
 {
 	return serialize(output, std::string_view(value));
 }
 
-void serialize(std::string& output, const serializable::List& value)
+inline void serialize(std::string& output, const serializable::List& value)
 {
 	output.push_back('l');
 	for (const auto& inner : value)
@@ -199,7 +200,7 @@ void serialize(std::string& output, const serializable::List& value)
 	output.push_back('e');
 }
 
-void serialize(std::string& output, const serializable::Sorted_dictionary& value)
+inline void serialize(std::string& output, const serializable::Sorted_dictionary& value)
 {
 	output.push_back('d');
 	for (const auto& [key, inner] : value)
@@ -414,31 +415,31 @@ struct Dictionary : Deserializable, std::vector<Field>
 	std::expected<void, Deserialization_error> append(std::vector<Deserializable*>& stack, deserialized::Byte_string value) final override;
 };
 
-std::expected<void, Deserialization_error> Deserializable::append(
+inline std::expected<void, Deserialization_error> Deserializable::append(
 	[[maybe_unused]] std::vector<Deserializable*>& stack, [[maybe_unused]] deserialized::Integer value)
 {
 	return std::unexpected(Deserialization_error::wrong_type);
 }
 
-std::expected<void, Deserialization_error> Deserializable::append(
+inline std::expected<void, Deserialization_error> Deserializable::append(
 	[[maybe_unused]] std::vector<Deserializable*>& stack, [[maybe_unused]] deserialized::Byte_string value)
 {
 	return std::unexpected(Deserialization_error::wrong_type);
 }
 
-std::expected<void, Deserialization_error> Deserializable::append(
+inline std::expected<void, Deserialization_error> Deserializable::append(
 	[[maybe_unused]] std::vector<Deserializable*>& stack, [[maybe_unused]] deserialized::List value)
 {
 	return std::unexpected(Deserialization_error::wrong_type);
 }
 
-std::expected<void, Deserialization_error> Deserializable::append(
+inline std::expected<void, Deserialization_error> Deserializable::append(
 	[[maybe_unused]] std::vector<Deserializable*>& stack, [[maybe_unused]] deserialized::Dictionary value)
 {
 	return std::unexpected(Deserialization_error::wrong_type);
 }
 
-std::expected<void, Deserialization_error> Deserializable::append(
+inline std::expected<void, Deserialization_error> Deserializable::append(
 	[[maybe_unused]] std::vector<Deserializable*>& stack, [[maybe_unused]] std::string_view value)
 {
 	return std::unexpected(Deserialization_error::wrong_type);
@@ -580,7 +581,7 @@ struct deserialized::Field : Deserializable
 	std::expected<void, Deserialization_error> append(std::vector<Deserializable*>& stack, deserialized::Dictionary value) final override;
 };
 
-std::expected<void, Deserialization_error> deserialized::Byte_string::append(
+inline std::expected<void, Deserialization_error> deserialized::Byte_string::append(
 	[[maybe_unused]] std::vector<Deserializable*>& stack, std::string_view value)
 {
 	if (value.size() <= size() - complete_size_)
@@ -593,7 +594,7 @@ std::expected<void, Deserialization_error> deserialized::Byte_string::append(
 	return std::unexpected(Deserialization_error::wrong_type);
 }
 
-std::expected<void, Deserialization_error> deserialized::List::append(std::vector<Deserializable*>& stack, deserialized::Integer value)
+inline std::expected<void, Deserialization_error> deserialized::List::append(std::vector<Deserializable*>& stack, deserialized::Integer value)
 {
 	emplace_back();
 	bool is_complete = value.is_complete();
@@ -604,7 +605,7 @@ std::expected<void, Deserialization_error> deserialized::List::append(std::vecto
 	return {};
 }
 
-std::expected<void, Deserialization_error> deserialized::List::append(std::vector<Deserializable*>& stack, deserialized::Byte_string value)
+inline std::expected<void, Deserialization_error> deserialized::List::append(std::vector<Deserializable*>& stack, deserialized::Byte_string value)
 {
 	emplace_back();
 	bool is_complete = value.is_complete();
@@ -615,7 +616,7 @@ std::expected<void, Deserialization_error> deserialized::List::append(std::vecto
 	return {};
 }
 
-std::expected<void, Deserialization_error> deserialized::List::append(std::vector<Deserializable*>& stack, deserialized::List value)
+inline std::expected<void, Deserialization_error> deserialized::List::append(std::vector<Deserializable*>& stack, deserialized::List value)
 {
 	emplace_back();
 	bool is_complete = value.is_complete();
@@ -626,7 +627,7 @@ std::expected<void, Deserialization_error> deserialized::List::append(std::vecto
 	return {};
 }
 
-std::expected<void, Deserialization_error> deserialized::List::append(std::vector<Deserializable*>& stack, deserialized::Dictionary value)
+inline std::expected<void, Deserialization_error> deserialized::List::append(std::vector<Deserializable*>& stack, deserialized::Dictionary value)
 {
 	emplace_back();
 	bool is_complete = value.is_complete();
@@ -637,7 +638,7 @@ std::expected<void, Deserialization_error> deserialized::List::append(std::vecto
 	return {};
 }
 
-std::expected<void, Deserialization_error> deserialized::Dictionary::append(std::vector<Deserializable*>& stack, deserialized::Byte_string value)
+inline std::expected<void, Deserialization_error> deserialized::Dictionary::append(std::vector<Deserializable*>& stack, deserialized::Byte_string value)
 {
 	if (empty() or back().is_complete())
 	{
@@ -655,7 +656,7 @@ std::expected<void, Deserialization_error> deserialized::Dictionary::append(std:
 	return std::unexpected(Deserialization_error::wrong_type);
 }
 
-std::expected<void, Deserialization_error> deserialized::Field::append(std::vector<Deserializable*>& stack, deserialized::Integer value)
+inline std::expected<void, Deserialization_error> deserialized::Field::append(std::vector<Deserializable*>& stack, deserialized::Integer value)
 {
 	if (name.is_complete() and std::holds_alternative<deserialized::Deserializable>(this->value))
 	{
@@ -670,7 +671,7 @@ std::expected<void, Deserialization_error> deserialized::Field::append(std::vect
 	return std::unexpected(Deserialization_error::wrong_type);
 }
 
-std::expected<void, Deserialization_error> deserialized::Field::append(std::vector<Deserializable*>& stack, deserialized::Byte_string value)
+inline std::expected<void, Deserialization_error> deserialized::Field::append(std::vector<Deserializable*>& stack, deserialized::Byte_string value)
 {
 	if (name.is_complete() and std::holds_alternative<deserialized::Deserializable>(this->value))
 	{
@@ -685,7 +686,7 @@ std::expected<void, Deserialization_error> deserialized::Field::append(std::vect
 	return std::unexpected(Deserialization_error::wrong_type);
 }
 
-std::expected<void, Deserialization_error> deserialized::Field::append(std::vector<Deserializable*>& stack, deserialized::List value)
+inline std::expected<void, Deserialization_error> deserialized::Field::append(std::vector<Deserializable*>& stack, deserialized::List value)
 {
 	if (name.is_complete() and std::holds_alternative<deserialized::Deserializable>(this->value))
 	{
@@ -700,7 +701,7 @@ std::expected<void, Deserialization_error> deserialized::Field::append(std::vect
 	return std::unexpected(Deserialization_error::wrong_type);
 }
 
-std::expected<void, Deserialization_error> deserialized::Field::append(std::vector<Deserializable*>& stack, deserialized::Dictionary value)
+inline std::expected<void, Deserialization_error> deserialized::Field::append(std::vector<Deserializable*>& stack, deserialized::Dictionary value)
 {
 	if (name.is_complete() and std::holds_alternative<deserialized::Deserializable>(this->value))
 	{
@@ -920,8 +921,26 @@ struct Streaming_deserializer
 {
 protected:
 	std::string data_;
+	
+	/// Called when the data start with a byte which cannot start a bencode value
+	/// and for the data claimed by claim_foreign_data, which allows embedding
+	/// other encodings in the stream
+	/// @return The number of bytes consumed, 0 to wait for more data
+	virtual std::size_t visit_foreign_data(std::string_view data)
+	{
+		throw Deserialization_exception(std::string("unknown value type: '") + std::string(data) + "'");
+	}
+	
+	/// The following @p length bytes are passed to visit_foreign_data regardless of their values
+	void claim_foreign_data(std::size_t length) noexcept
+	{
+		foreign_data_length_ = length;
+	}
+
 private:
 	std::optional<std::size_t> expected_byte_string_length_;
+	/// Number of following bytes claimed by the foreign data being visited
+	std::size_t foreign_data_length_ = 0;
 	std::string stack_;
 	
 	void consume(std::size_t size)
@@ -1068,13 +1087,53 @@ private:
 			}
 		}
 	}
-	
+
 public:
 	virtual ~Streaming_deserializer() = default;
 	
 	bool finished() const noexcept
 	{
-		return data_.empty() and stack_.empty() and not expected_byte_string_length_.has_value();
+		return data_.empty() and stack_.empty() and not expected_byte_string_length_.has_value() and foreign_data_length_ == 0;
+	}
+	
+	/// @return The length of the byte string the payload of which is being received,
+	/// data_ then only contains a prefix of the payload
+	std::optional<std::size_t> pending_byte_string_length() const noexcept
+	{
+		return expected_byte_string_length_;
+	}
+	
+	/// Removes the first @p length bytes of the payload of the pending byte string,
+	/// as if the caller has consumed them by other means, such as directly from the stream.
+	/// The visitor will only receive the rest of the byte string
+	void skip_byte_string_payload(std::size_t length)
+	{
+		if (not expected_byte_string_length_ or length > *expected_byte_string_length_)
+		{
+			throw Deserialization_exception(std::string("skipping more than the pending byte string"));
+		}
+		
+		consume(std::min(length, data_.size()));
+		*expected_byte_string_length_ -= length;
+	}
+	
+	/// @return The number of bytes of the foreign data claimed by the visitor which were not yet received
+	std::size_t pending_foreign_data_length() const noexcept
+	{
+		return foreign_data_length_;
+	}
+	
+	/// Removes the first @p length bytes of the claimed foreign data,
+	/// as if the caller has consumed them by other means
+	void skip_foreign_data(std::size_t length)
+	{
+		if (length > foreign_data_length_)
+		{
+			throw Deserialization_exception(std::string("skipping more than the pending foreign data"));
+		}
+		
+		consume(std::min(length, data_.size()));
+		foreign_data_length_ -= length;
 	}
 	
 	void receive(std::string_view data)
@@ -1087,11 +1146,26 @@ public:
 	{
 		while (true)
 		{
-			if (data_.empty())
+			// the rest of a skipped byte string may be empty
+			if (data_.empty() and expected_byte_string_length_ != 0)
 			{
 				break;
 			}
 			
+			if (foreign_data_length_ != 0)
+			{
+				auto size = visit_foreign_data(std::string_view(data_).substr(0, foreign_data_length_));
+				foreign_data_length_ -= size;
+				consume(size);
+				
+				if (size == 0)
+				{
+					break;
+				}
+				
+				continue;
+			}
+			
 			if (expected_byte_string_length_)
 			{
 				if (data_.size() >= *expected_byte_string_length_)
@@ -1228,9 +1302,14 @@ public:
 					throw Deserialization_exception(std::string("found end of collection 'e' with no previous beginning"));
 				}
 			}
+			else if (auto size = visit_foreign_data(data_); size != 0)
+			{
+				consume(size);
+			}
 			else
 			{
-				throw Deserialization_exception(std::string("unknown value type: '") + data_ + "'");
+				// wait for more data
+				break;
 			}
 		}
 	}
@@ -0,0 +1,390 @@
+#pragma once
+
+#include <client.hpp>
+#include <hash.hpp>
+#include <transport.hpp>
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/// Responses of deterministic commands stored in a directory on the local disk and replayed without
+/// connecting to the server. The key is a hash of the request, which consists of the arguments, the working
+/// directory, the environment variables listed in DAIYOUSEI_CACHE_ENV, the transport and the whole standard input.
+/// An entry holds the exit code as a 32-bit little-endian integer, the length of the request as a 64-bit
+/// little-endian integer, the request itself, which is compared on a hit so that colliding keys are not replayed,
+/// and the outputs in the order they were received, each as a binary frame of the capability 'frames',
+/// so that it is replayed directly from its mapping
+struct Cache
+{
+	constexpr static std::size_t exitcode_size = 4;
+	constexpr static std::size_t request_length_size = 8;
+	
+	using Mapping = std::experimental::unique_resource<std::span<const char>, void(*)(std::span<const char>)>;
+	
+	/// @return The first @p size bytes of the file mapped for reading, empty if @p size is 0 or the mapping failed
+	static Mapping map(int fd, std::size_t size)
+	{
+		auto mapping = size == 0 ? MAP_FAILED : mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		
+		return Mapping(mapping == MAP_FAILED ? std::span<const char>() : std::span(static_cast<const char*>(mapping), size), +[](std::span<const char> mapping) -> void
+		{
+			if (not mapping.empty())
+			{
+				munmap(const_cast<char*>(mapping.data()), mapping.size());
+			}
+		});
+	}
+	
+	std::filesystem::path directory_;
+	/// Set if the command is listed in DAIYOUSEI_CACHE_COMMANDS, its responses are then stored
+	/// without the server marking them as cacheable
+	bool listed_ = false;
+	
+	/// @return Nothing if the cache is disabled, if the standard input is a terminal
+	/// or if DAIYOUSEI_CACHE_COMMANDS is defined and does not list the command
+	static std::optional<Cache> from_env(const char* const* argv)
+	{
+		auto directory = std::getenv(global::env_name_cache.data());
+		
+		if (directory == nullptr or *directory == '\0' or isatty(0))
+		{
+			return std::nullopt;
+		}
+		
+		auto result = Cache();
+		result.directory_ = directory;
+		
+		if (auto commands = std::getenv(global::env_name_cache_commands.data()))
+		{
+			auto name = std::filesystem::path(argv[0]).filename().string();
+			
+			if (not contains(commands, name))
+			{
+				return std::nullopt;
+			}
+			
+			result.listed_ = true;
+		}
+		
+		return result;
+	}
+	
+	/// @return Whether the comma-separated @p list contains @p name
+	static bool contains(std::string_view list, std::string_view name) noexcept
+	{
+		while (not list.empty())
+		{
+			auto item = list.substr(0, list.find(','));
+			list.remove_prefix(std::min(list.size(), item.size() + 1));
+			
+			if (item == name)
+			{
+				return true;
+			}
+		}
+		
+		return false;
+	}
+	
+	/// The standard input from its current position
+	struct Input
+	{
+		Mapping mapping_;
+		std::string_view data_;
+	};
+	
+	/// Maps the standard input from its current position, a standard input which is not a regular file
+	/// is read whole into a memory file which then replaces it, so that the client sends it from there on a miss
+	static Input map_stdin()
+	{
+		struct stat stdin_stat;
+		
+		if (fstat(0, &stdin_stat))
+		{
+			throw std::runtime_error(std::string("failed to inspect the standard input: ") + std::strerror(errno));
+		}
+		
+		if (S_ISREG(stdin_stat.st_mode))
+		{
+			auto offset = std::max(lseek(0, 0, SEEK_CUR), off_t(0));
+			
+			if (stdin_stat.st_size <= offset)
+			{
+				return Input {.mapping_ = map(0, 0), .data_ = std::string_view()};
+			}
+			
+			auto mapping = map(0, stdin_stat.st_size);
+			
+			if (mapping.get().empty())
+			{
+				throw std::runtime_error(std::string("failed to map the standard input: ") + std::strerror(errno));
+			}
+			
+			madvise(const_cast<char*>(mapping.get().data()), mapping.get().size(), MADV_SEQUENTIAL);
+			auto data = std::string_view(mapping.get().data() + offset, mapping.get().size() - offset);
+			return Input {.mapping_ = std::move(mapping), .data_ = data};
+		}
+		
+		auto copy = std::experimental::make_unique_resource_checked(memfd_create("stdin", MFD_CLOEXEC), -1, &Client::checked_close);
+		
+		if (copy.get() == -1)
+		{
+			throw std::runtime_error(std::string("failed to create a memory file: ") + std::strerror(errno));
+		}
+		
+		auto buffer = std::array<char, 64 * 1024>();
+		auto size = std::size_t(0);
+		
+		while (true)
+		{
+			auto read_bytes = read(0, buffer.data(), buffer.size());
+			
+			if (read_bytes == -1 and (errno == EINTR or errno == EAGAIN or errno == EWOULDBLOCK))
+			{
+				// the standard input may have been left non-blocking by another process
+				auto descriptor = pollfd {.fd = 0, .events = POLLIN, .revents = 0};
+				poll(&descriptor, 1, -1);
+				continue;
+			}
+			else if (read_bytes == -1)
+			{
+				throw std::runtime_error(std::string("failed to read the standard input: ") + std::strerror(errno));
+			}
+			else if (read_bytes == 0)
+			{
+				break;
+			}
+			
+			write_all(copy.get(), std::string_view(buffer.data(), read_bytes), "the copy of the standard input");
+			size += read_bytes;
+		}
+		
+		if (lseek(copy.get(), 0, SEEK_SET) == -1 or dup2(copy.get(), 0) == -1)
+		{
+			throw std::runtime_error(std::string("failed to replace the standard input by its copy: ") + std::strerror(errno));
+		}
+		
+		auto mapping = map(copy.get(), size);
+		
+		if (size != 0 and mapping.get().empty())
+		{
+			throw std::runtime_error(std::string("failed to map the copy of the standard input: ") + std::strerror(errno));
+		}
+		
+		auto data = std::string_view(mapping.get().data(), mapping.get().size());
+		return Input {.mapping_ = std::move(mapping), .data_ = data};
+	}
+	
+	static void write_all(int fd, std::string_view data, std::string_view name)
+	{
+		while (not data.empty())
+		{
+			if (auto result = write(fd, data.data(), data.size()); result != -1)
+			{
+				data.remove_prefix(result);
+			}
+			else if (errno == EAGAIN or errno == EWOULDBLOCK)
+			{
+				auto descriptor = pollfd {.fd = fd, .events = POLLOUT, .revents = 0};
+				poll(&descriptor, 1, -1);
+			}
+			else if (errno != EINTR)
+			{
+				throw std::runtime_error(std::string("writing to ") + std::string(name) + " failed: " + std::strerror(errno));
+			}
+		}
+	}
+	
+	/// @return The request without the standard input, the transport is included because other servers
+	/// may answer the same command differently
+	static std::string serialize_request(const daiyousei::Request& request, std::string_view transport)
+	{
+		auto preamble = bencode::Serializer::create();
+		preamble.push_raw_data("l");
+		preamble.push_raw_data("4:argv");
+		preamble.push_raw_data("l");
+		for (auto argument : request.argv_)
+		{
+			preamble.push_byte_string(argument);
+		}
+		preamble.push_raw_data("e");
+		preamble.push_raw_data("3:cwd");
+		preamble.push_byte_string(request.cwd_);
+		preamble.push_raw_data("3:env");
+		preamble.push_raw_data("l");
+		
+		if (auto names = std::getenv(global::env_name_cache_env.data()))
+		{
+			for (auto list = std::string_view(names); not list.empty();)
+			{
+				auto name = std::string(list.substr(0, list.find(',')));
+				list.remove_prefix(std::min(list.size(), name.size() + 1));
+				
+				if (auto value = std::getenv(name.c_str()))
+				{
+					preamble.push_byte_string(name);
+					preamble.emplace_byte_string(value);
+				}
+			}
+		}
+		
+		preamble.push_raw_data("e");
+		preamble.push_raw_data("9:transport");
+		preamble.push_byte_string(transport);
+		preamble.push_raw_data("e");
+		
+		return std::move(preamble.buffer_);
+	}
+	
+	/// Writes the outputs of the entry to the standard output streams
+	/// @return The exit code, or nothing if the entry does not exist, is malformed
+	/// or was stored for another request
+	static std::optional<int> replay(const std::filesystem::path& path, std::string_view request, std::string_view input)
+	{
+		auto entry = std::experimental::make_unique_resource_checked(open(path.c_str(), O_RDONLY | O_CLOEXEC), -1, &Client::checked_close);
+		struct stat entry_stat;
+		
+		if (entry.get() == -1 or fstat(entry.get(), &entry_stat) or std::size_t(entry_stat.st_size) < exitcode_size + request_length_size)
+		{
+			return std::nullopt;
+		}
+		
+		auto mapping = map(entry.get(), entry_stat.st_size);
+		
+		if (mapping.get().empty())
+		{
+			return std::nullopt;
+		}
+		
+		auto data = std::string_view(mapping.get().data(), mapping.get().size());
+		auto request_length = std::uint64_t(0);
+		for (std::size_t i = 0; i != request_length_size; ++i)
+		{
+			request_length |= std::uint64_t(std::uint8_t(data[exitcode_size + i])) << (8 * i);
+		}
+		
+		auto stored_request = data.substr(exitcode_size + request_length_size);
+		
+		if (request_length != request.size() + input.size() or stored_request.size() < request_length
+			or stored_request.substr(0, request.size()) != request or stored_request.substr(request.size(), input.size()) != input)
+		{
+			return std::nullopt;
+		}
+		
+		auto frames = std::vector<std::pair<int, std::string_view>>();
+		
+		// the whole entry is validated before any output is written
+		for (auto rest = stored_request.substr(request_length); not rest.empty();)
+		{
+			if (rest.size() < Client::frame_header_size or (rest[0] != 1 and rest[0] != 2))
+			{
+				return std::nullopt;
+			}
+			
+			auto length = std::size_t(0);
+			for (std::size_t i = 0; i != 4; ++i)
+			{
+				length |= std::size_t(std::uint8_t(rest[1 + i])) << (8 * i);
+			}
+			
+			if (rest.size() - Client::frame_header_size < length)
+			{
+				return std::nullopt;
+			}
+			
+			frames.emplace_back(rest[0], rest.substr(Client::frame_header_size, length));
+			rest.remove_prefix(Client::frame_header_size + length);
+		}
+		
+		for (auto [fd, payload] : frames)
+		{
+			write_all(fd, payload, fd == 1 ? "stdout" : "stderr");
+		}
+		
+		auto exitcode = std::uint32_t(0);
+		for (std::size_t i = 0; i != exitcode_size; ++i)
+		{
+			exitcode |= std::uint32_t(std::uint8_t(data[i])) << (8 * i);
+		}
+		
+		return int(std::int32_t(exitcode));
+	}
+	
+	/// Stores the entry under a temporary name and renames it, so that concurrent clients never see
+	/// a partial entry, failures only mean that the response is not cached
+	static void store(const std::filesystem::path& path, int exitcode, std::string_view request, std::string_view input, std::string_view outputs) noexcept
+	{
+		auto error = std::error_code();
+		std::filesystem::create_directories(path.parent_path(), error);
+		
+		auto temporary = path;
+		temporary += "." + std::to_string(getpid()) + ".tmp";
+		auto entry = std::experimental::make_unique_resource_checked(
+			open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644), -1, +[](int fd) -> void
+		{
+			close(fd);
+		});
+		
+		if (entry.get() == -1)
+		{
+			return;
+		}
+		
+		auto header = std::array<char, exitcode_size + request_length_size>();
+		for (std::size_t i = 0; i != exitcode_size; ++i)
+		{
+			header[i] = char(std::uint32_t(exitcode) >> (8 * i));
+		}
+		
+		for (std::size_t i = 0; i != request_length_size; ++i)
+		{
+			header[exitcode_size + i] = char(std::uint64_t(request.size() + input.size()) >> (8 * i));
+		}
+		
+		try
+		{
+			write_all(entry.get(), std::string_view(header.data(), header.size()), "the cache entry");
+			write_all(entry.get(), request, "the cache entry");
+			write_all(entry.get(), input, "the cache entry");
+			write_all(entry.get(), outputs, "the cache entry");
+			
+			if (rename(temporary.c_str(), path.c_str()) == 0)
+			{
+				return;
+			}
+		}
+		catch (std::exception&)
+		{
+		}
+		
+		unlink(temporary.c_str());
+	}
+	
+	int run(const daiyousei::Request& request)
+	{
+		auto serialized = serialize_request(request, Transport::from_env().name_);
+		auto input = map_stdin();
+		
+		auto hash = Hash();
+		hash.update(serialized);
+		hash.update(input.data_);
+		auto path = directory_ / hash.hex();
+		
+		if (auto exitcode = replay(path, serialized, input.data_))
+		{
+			return *exitcode;
+		}
+		
+		auto recording = Client::Recording();
+		auto exitcode = Client(request, nullptr, &recording).run();
+		
+		if ((listed_ or recording.cacheable_) and not recording.overflow_)
+		{
+			store(path, exitcode, serialized, input.data_, recording.outputs_);
+		}
+		
+		return exitcode;
+	}
+};
@@ -2,405 +2,2858 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 
 #include <cerrno>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 
 #include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
 #include <cstring>
-#include <iostream>
-#include <filesystem>
+#include <deque>
+#include <limits>
+#include <numeric>
+#include <span>
 #include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
 #include <experimental/scope>
 #include <experimental/array>
 
 #include <bencode.hpp>
+#include <global.hpp>
+#include <probes.hpp>
+#include <session.hpp>
+#include <shared_memory.hpp>
+#include <stats.hpp>
+#include <trace.hpp>
+#include <transport.hpp>
 
-extern char** environ;
+#ifdef DAIYOUSEI_IO_URING
+#include <io_uring.hpp>
+#endif
 
-namespace global
-{
-constexpr std::string_view program_name = "daiyousei";
-constexpr std::string_view default_unix_socket_name = "daiyousei.sock";
-constexpr std::string_view env_name_unix_socket = "DAIYOUSEI_UNIX_SOCKET";
-} // namespace global
+extern char** environ;
 
 struct Epoll_client
 {
+	using File_flags = std::experimental::unique_resource<std::pair<int, int>, void(*)(std::pair<int, int>)>;
+	
+	/// Set if DAIYOUSEI_TRACE is defined, first so that its start precedes all the work of the client
+	std::optional<Trace> trace_ = Trace::from_env();
 	std::experimental::unique_resource<int, void(*)(int)> epoll_fd_;
 	std::experimental::unique_resource<int, void(*)(int)> socket_;
+	Transport transport_ = Transport::from_env();
+	/// The longest message which can be sent if the socket preserves message boundaries
+	std::size_t max_message_size_ = std::numeric_limits<std::size_t>::max();
+	
+	enum struct Stdin_type
+	{
+		/// Added to epoll
+		pollable,
+		/// Sent using sendfile(2), not added to epoll, read like not_pollable if the socket preserves message boundaries
+		regular_file,
+		/// Cannot be added to epoll, such as /dev/null, read whenever the outbound queue allows it
+		not_pollable,
+		/// Read by io_uring(7) whatever its type
+		io_uring,
+	}
+	stdin_type_;
+	
+	/// Set if the client runs the commands of a batch one after another
+	bool batch_ = std::getenv(global::env_name_batch.data()) != nullptr;
+
+#ifdef DAIYOUSEI_IO_URING
+	/// Size of the registered buffer for the standard input
+	constexpr static std::size_t uring_buffer_size = 64 * 1024;
+	
+	/// Used instead of epoll if requested, supported by the kernel and if no feature which needs epoll is enabled
+	std::optional<uring::Ring> uring_ = [this]() -> std::optional<uring::Ring>
+	{
+		if (std::getenv(global::env_name_io_uring.data()) == nullptr or transport_.type_ != SOCK_STREAM
+			or std::ranges::any_of(std::experimental::make_array(global::env_name_stdin_coalesce, global::env_name_splice_threshold,
+				global::env_name_pass_fds, global::env_name_shared_memory, global::env_name_server_command, global::env_name_batch,
+				global::env_name_digests), [](std::string_view name) -> bool
+			{
+				return std::getenv(name.data()) != nullptr;
+			}))
+		{
+			return std::nullopt;
+		}
+		
+		return uring::Ring::create(64, uring_buffer_size);
+	}();
+#endif
+
+	/// Whether the operations are submitted to io_uring(7) instead of being performed when epoll reports readiness
+	bool uses_uring() const noexcept
+	{
+#ifdef DAIYOUSEI_IO_URING
+		return uring_.has_value();
+#else
+		return false;
+#endif
+	}
+	
+	/// Original flags of the standard streams, restored on exit so that the
+	/// non-blocking mode does not leak into processes sharing the terminal
+	std::array<File_flags, 3> stdio_flags_;
 	
 	static void checked_close(int fd)
 	{
 		if (close(fd))
 		{
-			std::clog << global::program_name << ": failed to close file descriptor " << fd << ": " << std::strerror(errno) << "\n";
+			global::report({"failed to close file descriptor ", std::to_string(fd), ": ", std::strerror(errno)});
 		}
 	}
 	
-	Epoll_client()
+	/// @return The current working directory by getcwd(3) without std::filesystem
+	static std::string current_directory()
 	{
-		auto socket_fd = std::experimental::make_unique_resource_checked(socket(AF_UNIX, SOCK_STREAM, 0), -1, &checked_close);
-		if (socket_fd.get() == -1)
+		auto result = std::string(256, '\0');
+		
+		while (getcwd(result.data(), result.size()) == nullptr)
 		{
-			throw std::runtime_error(std::string("failed to create a unix socket: ") + std::strerror(errno));
+			if (errno != ERANGE)
+			{
+				throw std::runtime_error(std::string("failed to get the current working directory: ") + std::strerror(errno));
+			}
+			
+			result.resize(result.size() * 2);
 		}
 		
-		auto address = sockaddr_un();
-		address.sun_family = AF_UNIX;
-		auto sun_path = std::string();
+		result.resize(std::char_traits<char>::length(result.data()));
+		return result;
+	}
+	
+	/// @return The names and values of the environment variables of the process
+	static std::vector<std::pair<std::string_view, std::string_view>> process_environment()
+	{
+		auto result = std::vector<std::pair<std::string_view, std::string_view>>();
 		
-		if (auto unix_socket = std::getenv(global::env_name_unix_socket.data()))
+		for (const char* const* env = environ; *env != nullptr; ++env)
 		{
-			sun_path = unix_socket;
+			auto variable = std::string_view(*env);
+			auto mid = variable.find('=');
+			result.emplace_back(variable.substr(0, mid), variable.substr(std::min(mid + 1, variable.size())));
 		}
-		else if (auto runtime_dir = std::getenv("XDG_RUNTIME_DIR"))
+		
+		return result;
+	}
+	
+	static void restore_flags(std::pair<int, int> fd_flags)
+	{
+		if (fcntl(fd_flags.first, F_SETFL, fd_flags.second))
 		{
-			sun_path = (std::filesystem::path(runtime_dir) / global::default_unix_socket_name).string();
+			global::report({"failed to restore flags of file descriptor ", std::to_string(fd_flags.first), ": ", std::strerror(errno)});
 		}
-		else
+	}
+	
+	static File_flags set_nonblocking(int fd, std::string_view name)
+	{
+		auto flags = fcntl(fd, F_GETFL);
+		
+		if (flags == -1 or fcntl(fd, F_SETFL, flags | O_NONBLOCK))
 		{
-			sun_path = (std::filesystem::path("/tmp") / global::default_unix_socket_name).string();
+			throw std::runtime_error(std::string("failed to set non-blocking mode for the ") + std::string(name) + ": " + std::strerror(errno));
 		}
 		
-		if (sun_path.size() >= std::size(address.sun_path))
+		return File_flags(std::pair(fd, flags), &restore_flags);
+	}
+	
+	/// @return The value of the environment variable @p name if it is defined, it must be a positive integer
+	static std::optional<std::size_t> size_from_env(std::string_view name)
+	{
+		auto env_value = std::getenv(name.data());
+		
+		if (env_value == nullptr)
 		{
-			throw std::runtime_error(std::string("value of " + std::string(global::env_name_unix_socket) + " too long, value is: ") + sun_path);
+			return std::nullopt;
 		}
-		std::ranges::copy(sun_path, address.sun_path);
 		
-		auto epoll_fd = std::experimental::make_unique_resource_checked(epoll_create1(0), -1, &checked_close);
-		if (epoll_fd.get() == -1)
+		auto value = std::string_view(env_value);
+		auto result = std::size_t();
+		
+		if (std::from_chars(value.data(), value.data() + value.size(), result) != std::from_chars_result(value.data() + value.size(), std::errc())
+			or result == 0)
 		{
-			throw std::runtime_error(std::string("failed to create epoll file descriptor: ") + std::strerror(errno));
+			throw std::runtime_error(std::string("invalid value of ") + std::string(name) + ", expected a positive integer, value is: " + std::string(value));
 		}
 		
+		return result;
+	}
+	
+	static void set_socket_option(int fd, int level, int name, int value, std::string_view description)
+	{
+		if (setsockopt(fd, level, name, &value, sizeof(value)))
 		{
-			auto event = epoll_event();
-			event.events = EPOLLIN;
-			
-			event.data.fd = 0;
-			if (epoll_ctl(epoll_fd.get(), EPOLL_CTL_ADD, 0, &event))
-			{
-				throw std::runtime_error(std::string("failed to add standard input file descriptor to epoll: ") + std::strerror(errno));
-			}
-			
-			event.data.fd = socket_fd.get();
-			if (epoll_ctl(epoll_fd.get(), EPOLL_CTL_ADD, socket_fd.get(), &event))
-			{
-				throw std::runtime_error(std::string("failed to add unix socket file descriptor to epoll: ") + std::strerror(errno));
-			}
+			throw std::runtime_error(std::string("failed to set socket option ") + std::string(description) + ": " + std::strerror(errno));
 		}
+	}
+	
+	/// Sets the options of the socket according to the transport
+	void configure_socket(int fd)
+	{
+		auto buffer_size = size_from_env(global::env_name_socket_buffer_size);
 		
-		if (fcntl(0, F_SETFL, O_NONBLOCK))
+		if (transport_.domain_ != AF_UNIX)
 		{
-			throw std::runtime_error(std::string("failed to set non-blocking mode for the standard input stream: ") + std::strerror(errno));
+			set_socket_option(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
 		}
 		
-		if (fcntl(socket_fd.get(), F_SETFL, O_NONBLOCK))
+		if (buffer_size)
 		{
-			throw std::runtime_error(std::string("failed to set non-blocking mode for unix socket") + sun_path + ": " + std::strerror(errno));
+			set_socket_option(fd, SOL_SOCKET, SO_RCVBUF, int(std::min<std::size_t>(*buffer_size, std::numeric_limits<int>::max())), "SO_RCVBUF");
 		}
 		
-		if (connect(socket_fd.get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)))
+		// the send buffer holds the whole throttled outbound queue, the receive buffer is left
+		// to the kernel because setting it disables the automatic tuning of the TCP window,
+		// the send buffer also limits the size of a message which preserves boundaries
+		if (buffer_size or transport_.domain_ != AF_UNIX or transport_.type_ == SOCK_SEQPACKET)
 		{
-			throw std::runtime_error(std::string("failed to connect to unix socket ") + sun_path + ": " + std::strerror(errno));
+			set_socket_option(fd, SOL_SOCKET, SO_SNDBUF, int(std::min<std::size_t>(buffer_size.value_or(1024 * 1024), std::numeric_limits<int>::max())), "SO_SNDBUF");
 		}
 		
-		epoll_fd_ = std::move(epoll_fd);
-		socket_ =  std::move(socket_fd);
+		if (transport_.type_ == SOCK_SEQPACKET)
+		{
+			auto send_buffer_size = int();
+			auto length = socklen_t(sizeof(send_buffer_size));
+			
+			if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &send_buffer_size, &length))
+			{
+				throw std::runtime_error(std::string("failed to get socket option SO_SNDBUF: ") + std::strerror(errno));
+			}
+			
+			// the kernel reserves a small part of the buffer for itself
+			max_message_size_ = std::max(send_buffer_size, 64) - 32;
+		}
 	}
-};
-
-struct Client : Epoll_client, bencode::Streaming_deserializer
-{
-	std::optional<bencode::deserialized::Integer> exitcode_;
-	bencode::Serializer::Serializer_buffer serializer_;
 	
-	static std::size_t read_into(int fd, std::string& output)
+	/// Connecting gives up after this time, including waiting for a connection in progress
+	std::chrono::milliseconds connect_timeout_ = std::chrono::milliseconds(size_from_env(global::env_name_connect_timeout).value_or(10'000));
+	/// Counts the connection attempts repeated because the listen backlog of the server was full
+	daiyousei::Connect_backoff connect_backoff_;
+	/// Shell command which starts the server if its socket does not exist or refuses connections
+	const char* server_command_ = std::getenv(global::env_name_server_command.data());
+	
+	/// Waits until a connection in progress, such as a TCP connection, is established,
+	/// the socket is watched for EPOLLOUT only for this time
+	void wait_connected(int fd, int epoll_fd, std::chrono::steady_clock::time_point deadline)
 	{
-		auto total_read_bytes = std::size_t(0);
-		auto error = std::optional<std::runtime_error>();
+		auto event = epoll_event();
+		event.events = EPOLLOUT;
+		event.data.fd = fd;
+		
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event))
+		{
+			throw std::runtime_error(std::string("failed to wait for connection to ") + transport_.name_ + ": " + std::strerror(errno));
+		}
 		
 		while (true)
 		{
-			auto prev_size = output.size();
-			output.resize(prev_size + 128);
-			auto read_bytes = read(fd, output.data() + prev_size, output.size() - prev_size);
+			auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+			auto ready_events = epoll_wait(epoll_fd, &event, 1, int(std::max(remaining.count(), decltype(remaining)::rep(0))));
 			
-			if (read_bytes == -1)
+			if (ready_events == 1)
 			{
-				read_bytes = 0;
-				
-				if (errno == EWOULDBLOCK or errno == EAGAIN)
-				{
-					// ignore
-				}
-				else
-				{
-					error.emplace(std::runtime_error(std::string("read from file descriptor '" + std::to_string(fd) + "' failed: " + std::strerror(errno))));
-				}
+				break;
 			}
-			
-			output.resize(prev_size + read_bytes);
-			
-			total_read_bytes += read_bytes;
-			
-			if (read_bytes == 0)
+			else if (ready_events == 0)
 			{
-				break;
+				throw std::runtime_error(std::string("failed to connect to ") + transport_.name_ + ": " + std::strerror(ETIMEDOUT));
+			}
+			else if (errno != EINTR)
+			{
+				throw std::runtime_error(std::string("failed to wait for connection to ") + transport_.name_ + ": " + std::strerror(errno));
 			}
 		}
 		
-		if (error)
+		event.events = EPOLLIN;
+		
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event))
 		{
-			throw *error;
+			throw std::runtime_error(std::string("failed to wait for connection to ") + transport_.name_ + ": " + std::strerror(errno));
 		}
 		
-		return total_read_bytes;
+		auto error = int();
+		auto length = socklen_t(sizeof(error));
+		
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1)
+		{
+			error = errno;
+		}
+		
+		if (error != 0)
+		{
+			throw std::runtime_error(std::string("failed to connect to ") + transport_.name_ + ": " + std::strerror(error));
+		}
 	}
 	
-	Client(int argc, const char* const* argv)
+	/// Binds a listening socket at the path of the transport and runs the server command with it
+	/// like systemd(1) socket activation does, as file descriptor 3 with LISTEN_FDS and LISTEN_PID set,
+	/// so that the clients can connect before the server is ready, their connections wait in the backlog
+	void start_server()
 	{
-		serializer_.push_raw_data("l");
-		serializer_.push_raw_data("4:argv");
-		serializer_.push_raw_data("l");
-		for (int i = 0; i != argc; ++i)
+		auto listening = std::experimental::make_unique_resource_checked(socket(transport_.domain_, transport_.type_ | SOCK_CLOEXEC, 0), -1, &checked_close);
+		if (listening.get() == -1)
 		{
-			serializer_.emplace_byte_string(argv[i]);
+			throw std::runtime_error(std::string("failed to create a socket: ") + std::strerror(errno));
 		}
-		serializer_.push_raw_data("e");
-		serializer_.push_raw_data("3:cwd");
-		serializer_.emplace_byte_string(std::filesystem::current_path().c_str());
-		serializer_.push_raw_data("3:env");
-		serializer_.push_raw_data("l");
 		
-		for (const char* const* env = environ; *env != nullptr; ++env)
+		// a socket file left by a server which has exited refuses connections
+		if (unlink(transport_.path_.c_str()) and errno != ENOENT)
 		{
-			std::size_t mid = 0;
-			while ((*env)[mid] != '=')
-			{
-				++mid;
-			}
-			std::size_t end = mid + 1;
-			while ((*env)[end] != '\0')
-			{
-				++end;
-			}
-			
-			serializer_.emplace_byte_string(*env, mid);
-			serializer_.emplace_byte_string(*env + mid + 1, *env + end);
+			throw std::runtime_error(std::string("failed to remove the stale ") + transport_.name_ + ": " + std::strerror(errno));
 		}
-		serializer_.push_raw_data("e");
 		
-		send(serializer_.take());
-	}
-	
-	std::ptrdiff_t send(std::string_view data)
-	{
-		if (auto result = ::send(socket_.get(), data.data(), data.size(), MSG_NOSIGNAL); result != -1)
+		if (bind(listening.get(), reinterpret_cast<sockaddr*>(&transport_.address_), transport_.address_length_) or listen(listening.get(), SOMAXCONN))
 		{
-			return result;
+			throw std::runtime_error(std::string("failed to listen on ") + transport_.name_ + ": " + std::strerror(errno));
 		}
-		else
+		
+		auto pid = fork();
+		
+		if (pid == -1)
 		{
-			throw std::runtime_error(std::string("failed to send message: ") + std::strerror(errno));
+			throw std::runtime_error(std::string("failed to start the server: ") + std::strerror(errno));
+		}
+		else if (pid == 0)
+		{
+			// the server outlives the client, it must not keep the standard streams of the client open
+			auto null = open("/dev/null", O_RDWR);
+			
+			if (setsid() != -1 and null != -1 and dup2(null, 0) != -1 and dup2(null, 1) != -1 and dup2(null, 2) != -1
+				and dup2(listening.get(), 3) != -1 and fcntl(3, F_SETFD, 0) != -1)
+			{
+				setenv("LISTEN_FDS", "1", true);
+				setenv("LISTEN_PID", std::to_string(getpid()).c_str(), true);
+				setenv("LISTEN_FDNAMES", "daiyousei", true);
+				execl("/bin/sh", "sh", "-c", server_command_, nullptr);
+			}
+			
+			_exit(127);
 		}
 	}
 	
-	int run()
+	/// Connects the non-blocking socket, a Unix domain socket fails with EAGAIN while the listen backlog
+	/// of the server is full, the connection is then retried after the backoff.
+	/// If the server command is set and the socket does not exist or refuses connections,
+	/// the clients take turns holding an exclusive lock next to the socket, the first one starts the server
+	/// and the others find it running when they try again
+	void connect_socket(int fd, int epoll_fd)
 	{
-		auto events = std::array<epoll_event, 8>();
-		bool server_input_available = true;
-		auto input = std::string();
-		input.reserve(128);
+		connect_backoff_.deadline_ = std::chrono::steady_clock::now() + connect_timeout_;
+		auto lock = std::experimental::make_unique_resource_checked(-1, -1, &checked_close);
+		auto server_started = false;
 		
+		while (connect(fd, reinterpret_cast<sockaddr*>(&transport_.address_), transport_.address_length_) == -1)
 		{
-			auto communication = std::experimental::unique_resource(socket_.get(), +[](int fd) -> void
+			if (errno == EINPROGRESS)
 			{
-				// attempt to tell the server that stdin was closed
-				// ignore EPIPE if the server has already closed the connection
-				::send(fd, "e", 1, MSG_NOSIGNAL);
-				
-				if (auto result = shutdown(fd, SHUT_WR); result == -1)
-				{
-					std::clog << global::program_name << ": socket shutdown failed: " << std::strerror(errno);
-				}
-			});
-			
-			while (server_input_available and communication_status_ != Communication_status::terminated)
+				wait_connected(fd, epoll_fd, connect_backoff_.deadline_);
+				return;
+			}
+			else if ((errno == ENOENT or errno == ECONNREFUSED) and server_command_ and not transport_.path_.empty() and not server_started)
 			{
-				auto ready_events = epoll_wait(epoll_fd_.get(), events.data(), events.size(), -1);
-				for (int i = 0; i != ready_events; ++i)
+				if (lock.get() == -1)
 				{
-					if (events[i].data.fd == 0)
+					auto lock_path = transport_.path_ + ".lock";
+					lock = std::experimental::make_unique_resource_checked(open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600), -1, &checked_close);
+					
+					if (lock.get() == -1)
 					{
-						read_into(events[i].data.fd, input);
-						
-						if (input.size() == 0)
+						throw std::runtime_error(std::string("failed to open the lock file ") + lock_path + ": " + std::strerror(errno));
+					}
+					
+					// the client holding the lock is starting the server, it is waited for until the connect deadline
+					while (flock(lock.get(), LOCK_EX | LOCK_NB))
+					{
+						if (errno == EWOULDBLOCK and std::chrono::steady_clock::now() < connect_backoff_.deadline_)
 						{
-							communication.reset();
+							std::this_thread::sleep_until(std::min<std::chrono::steady_clock::time_point>(
+								std::chrono::steady_clock::now() + std::chrono::milliseconds(1), connect_backoff_.deadline_));
 						}
-						else
+						else if (errno == EWOULDBLOCK)
 						{
-							serializer_.push_raw_data("5:stdin");
-							serializer_.emplace_byte_string(input);
-							input.clear();
-							send(serializer_.take());
+							throw std::runtime_error(std::string("failed to connect to ") + transport_.name_
+								+ ": timed out waiting for the lock " + lock_path + " of the client starting the server");
 						}
-					}
-					else
-					{
-						auto read_result = read_into(events[i].data.fd, data_);
-						if (read_result == 0)
+						else if (errno != EINTR)
 						{
-							server_input_available = false;
+							throw std::runtime_error(std::string("failed to lock the file ") + lock_path + ": " + std::strerror(errno));
 						}
-						
-						receive();
 					}
 				}
+				else
+				{
+					start_server();
+					server_started = true;
+				}
+				
+				continue;
 			}
+			
+			std::this_thread::sleep_until(connect_backoff_.retry(errno, transport_));
 		}
-		
-		if (not server_input_available and communication_status_ != Communication_status::terminated)
+	}
+	
+	/// @param connected A connection kept from the previous request of a batch, a new one is made if it is empty
+	Epoll_client(std::optional<std::experimental::unique_resource<int, void(*)(int)>> connected = std::nullopt)
+	{
+		auto socket_fd = connected ? std::move(*connected)
+			: std::experimental::make_unique_resource_checked(socket(transport_.domain_, transport_.type_ | SOCK_CLOEXEC, 0), -1, &checked_close);
+		if (socket_fd.get() == -1)
 		{
-			throw std::runtime_error(std::string("communication terminated by the server without sending end of list"));
+			throw std::runtime_error(std::string("failed to create a socket: ") + std::strerror(errno));
 		}
 		
-		if (not data_.empty())
+		configure_socket(socket_fd.get());
+		
+		if (uses_uring())
 		{
-			throw std::runtime_error(std::string("communication terminated with trailing data: ") + data_);
+			// the socket is connected by the first submission, the standard streams are left
+			// blocking because io_uring(7) waits for them itself
+			stdin_type_ = Stdin_type::io_uring;
+			socket_ = std::move(socket_fd);
+			return;
 		}
 		
-		if (exitcode_)
+		auto epoll_fd = std::experimental::make_unique_resource_checked(epoll_create1(EPOLL_CLOEXEC), -1, &checked_close);
+		if (epoll_fd.get() == -1)
 		{
-			return exitcode_.value();
+			throw std::runtime_error(std::string("failed to create epoll file descriptor: ") + std::strerror(errno));
 		}
-		else
+		
 		{
-			throw std::runtime_error("communication terminated without setting the exit code");
+			auto event = epoll_event();
+			event.events = EPOLLIN;
+			
+			struct stat stdin_stat;
+			if (fstat(0, &stdin_stat))
+			{
+				throw std::runtime_error(std::string("failed to inspect the standard input stream: ") + std::strerror(errno));
+			}
+			
+			event.data.fd = 0;
+			// a file sent by sendfile(2) could be cut off in the middle of a chunk when the response ends,
+			// which would break the following request of a batch
+			if (S_ISREG(stdin_stat.st_mode) and (transport_.type_ == SOCK_SEQPACKET or batch_))
+			{
+				stdin_type_ = Stdin_type::not_pollable;
+			}
+			else if (S_ISREG(stdin_stat.st_mode))
+			{
+				stdin_type_ = Stdin_type::regular_file;
+			}
+			else if (epoll_ctl(epoll_fd.get(), EPOLL_CTL_ADD, 0, &event) == 0)
+			{
+				stdin_type_ = Stdin_type::pollable;
+			}
+			else if (errno == EPERM)
+			{
+				stdin_type_ = Stdin_type::not_pollable;
+			}
+			else
+			{
+				throw std::runtime_error(std::string("failed to add standard input file descriptor to epoll: ") + std::strerror(errno));
+			}
+			
+			event.data.fd = socket_fd.get();
+			if (epoll_ctl(epoll_fd.get(), EPOLL_CTL_ADD, socket_fd.get(), &event))
+			{
+				throw std::runtime_error(std::string("failed to add socket file descriptor to epoll: ") + std::strerror(errno));
+			}
 		}
-	}
-	
-	enum struct Communication_status
-	{
-		not_started,
-		ongoing,
-		terminated,
-	}
-	communication_status_;
-	
-	void visit_list_begin() override
-	{
-		if (communication_status_ == Communication_status::ongoing)
+		
+		stdio_flags_[0] = set_nonblocking(0, "standard input stream");
+		stdio_flags_[1] = set_nonblocking(1, "standard output stream");
+		stdio_flags_[2] = set_nonblocking(2, "standard error stream");
+		
+		if (fcntl(socket_fd.get(), F_SETFL, O_NONBLOCK))
 		{
-			throw std::runtime_error(std::string("unexpected start of list"));
+			throw std::runtime_error(std::string("failed to set non-blocking mode for ") + transport_.name_ + ": " + std::strerror(errno));
 		}
-		else if (communication_status_ == Communication_status::terminated)
+		
+		if (not connected)
 		{
-			throw std::runtime_error(std::string("unexpected start of list"));
+			connect_socket(socket_fd.get(), epoll_fd.get());
 		}
-		else
+		
+		DAIYOUSEI_PROBE(connected, socket_fd.get(), connect_backoff_.retries_);
+		
+		if (trace_)
 		{
-			communication_status_ = Communication_status::ongoing;
+			trace_->mark(Trace::Phase::connected);
 		}
+		
+		epoll_fd_ = std::move(epoll_fd);
+		socket_ =  std::move(socket_fd);
 	}
 	
-	void visit_list_end() override
+	/// Changes the events of @p fd from @p watched to @p events,
+	/// the file descriptor is removed from epoll when there are no events
+	/// because EPOLLHUP and EPOLLERR would be reported even with an empty event mask
+	void watch(int fd, std::uint32_t& watched, std::uint32_t events)
 	{
-		if (communication_status_ == Communication_status::not_started)
+		if (watched == events)
 		{
-			throw std::runtime_error(std::string("unexpected end of list"));
+			return;
 		}
-		else if (communication_status_ == Communication_status::terminated)
+		
+		auto event = epoll_event();
+		event.events = events;
+		event.data.fd = fd;
+		
+		auto operation = EPOLL_CTL_MOD;
+		if (watched == 0)
 		{
-			throw std::runtime_error(std::string("unexpected end of list"));
+			operation = EPOLL_CTL_ADD;
 		}
-		else
+		else if (events == 0)
 		{
-			communication_status_ = Communication_status::terminated;
+			operation = EPOLL_CTL_DEL;
 		}
+		
+		if (epoll_ctl(epoll_fd_.get(), operation, fd, &event))
+		{
+			throw std::runtime_error(std::string("failed to change epoll events of file descriptor ") + std::to_string(fd) + ": " + std::strerror(errno));
+		}
+		
+		watched = events;
 	}
+};
+
+/// The session of the client program, which connects the standard streams of the process to the server
+struct Client : Epoll_client, daiyousei::Session
+{
+	/// Size of the first read from a file descriptor after it becomes readable
+	constexpr static std::size_t min_read_size = 4096;
 	
-	void visit_dictionary_begin() override
-	{
-		throw std::runtime_error(std::string("unexpected start of dictionary"));
-	}
-	
-	void visit_dictionary_end() override
-	{
-		throw std::runtime_error(std::string("unexpected end of dictionary"));
-	}
-	
-	std::string last_key_;
+	/// Maximum amount of data read from a file descriptor at once,
+	/// so that a fast producer cannot bypass the high water marks
+	std::size_t max_read_size_ = 64 * 1024;
 	
-	void visit_byte_string(std::string_view value) override
+	/// Reads until there is no more data available or at least max_read_size_ bytes were read.
+	/// If a read fills the whole buffer, the size of the next one is the amount of pending data
+	/// reported by the file descriptor, or double the previous size if it is not reported
+	std::size_t read_into(int fd, std::string& output)
 	{
-		if (last_key_.empty())
+		auto total_read_bytes = std::size_t(0);
+		auto read_size = std::min(min_read_size, max_read_size_);
+		
+		while (total_read_bytes < max_read_size_)
 		{
-			bool is_valid = std::ranges::any_of(std::experimental::make_array<std::string_view>("exitcode", "stdout", "stderr"),
-			[&value](std::string_view key) -> bool
+			auto prev_size = output.size();
+			auto read_bytes = ssize_t();
+			
+			output.resize_and_overwrite(prev_size + read_size, [&](char* data, std::size_t) -> std::size_t
 			{
-				return value == key;
+				read_bytes = read(fd, data + prev_size, read_size);
+				return prev_size + std::max(read_bytes, ssize_t(0));
 			});
+			++statistics_.reads_;
 			
-			if (not is_valid)
+			if (read_bytes == -1)
 			{
-				throw std::runtime_error(std::string("key '") + std::string(value) + "' is not valid");
+				if (errno == EWOULDBLOCK or errno == EAGAIN)
+				{
+					break;
+				}
+				
+				throw std::runtime_error(std::string("read from file descriptor '" + std::to_string(fd) + "' failed: " + std::strerror(errno)));
 			}
 			
-			last_key_ = value;
-		}
-		else
-		{
-			constexpr auto keys = std::experimental::make_array<std::string_view>("stdout", "stderr");
+			total_read_bytes += read_bytes;
+			
+			if (std::size_t(read_bytes) < read_size)
+			{
+				// end of file or no more data available at the moment
+				break;
+			}
 			
-			for (std::size_t i = 0; i != std::size(keys); ++i)
+			if (auto available = int(); ioctl(fd, FIONREAD, &available) == 0)
 			{
-				if (last_key_ == keys[i])
+				++statistics_.reads_;
+				
+				if (available == 0)
 				{
-					for (std::ptrdiff_t len = 0; len != std::ssize(value);)
-					{
-						auto result = write(i + 1, value.data() + len, value.size() - len);
-						if (result != -1)
-						{
-							len += result;
-						}
-						else
-						{
-							throw std::runtime_error(std::string("writing to ") + std::string(keys[i]) + " failed: " + std::strerror(errno));
-						}
-					}
 					break;
 				}
+				
+				read_size = available;
+			}
+			else
+			{
+				read_size *= 2;
 			}
 			
-			last_key_.clear();
+			read_size = std::min(read_size, max_read_size_ - total_read_bytes);
 		}
+		
+		return total_read_bytes;
 	}
 	
-	void visit_integer(bencode::Integer value) override
+	/// Reads whole messages from a socket which preserves message boundaries,
+	/// each read is sized by the length of the next message so that it is not truncated
+	std::size_t read_messages(int fd, std::string& output)
 	{
-		if (last_key_.empty())
-		{
-			throw std::runtime_error(std::string("unexpected integer, value: ") + std::to_string(value));
-		}
-		else if (last_key_ == "exitcode")
+		auto total_read_bytes = std::size_t(0);
+		
+		while (total_read_bytes < max_read_size_)
 		{
-			if (std::exchange(exitcode_, value))
+			auto available = int();
+			if (ioctl(fd, FIONREAD, &available))
 			{
-				throw std::runtime_error("multiple exit codes set");
+				throw std::runtime_error(std::string("failed to get the size of the next message from file descriptor '" + std::to_string(fd) + "': ") + std::strerror(errno));
 			}
+			++statistics_.reads_;
 			
-			last_key_.clear();
-		}
-		else
-		{
-			throw std::runtime_error(std::string("unexpected integer value for key '" + last_key_ + "', value: ") + std::to_string(value));
+			auto read_size = std::max(std::size_t(available), std::size_t(1));
+			auto prev_size = output.size();
+			auto read_bytes = ssize_t();
+			
+			output.resize_and_overwrite(prev_size + read_size, [&](char* data, std::size_t) -> std::size_t
+			{
+				read_bytes = recv(fd, data + prev_size, read_size, MSG_TRUNC);
+				return prev_size + std::clamp(read_bytes, ssize_t(0), ssize_t(read_size));
+			});
+			++statistics_.reads_;
+			
+			if (read_bytes == -1)
+			{
+				if (errno == EWOULDBLOCK or errno == EAGAIN)
+				{
+					break;
+				}
+				
+				throw std::runtime_error(std::string("read from file descriptor '" + std::to_string(fd) + "' failed: " + std::strerror(errno)));
+			}
+			else if (std::size_t(read_bytes) > read_size)
+			{
+				throw std::runtime_error("message of " + std::to_string(read_bytes) + " bytes from file descriptor '" + std::to_string(fd) + "' was truncated");
+			}
+			else if (read_bytes == 0)
+			{
+				// end of file
+				break;
+			}
+			
+			total_read_bytes += read_bytes;
+		}
+		
+		return total_read_bytes;
+	}
+	
+	/// Standard input is collected until either the size is reached or the delay has passed since the first unsent byte
+	struct Stdin_coalescing
+	{
+		std::size_t size_;
+		std::chrono::microseconds delay_;
+		
+		/// Parses the value in the format <size>:<delay in microseconds>
+		static Stdin_coalescing parse(std::string_view value)
+		{
+			auto result = Stdin_coalescing();
+			auto delay = std::chrono::microseconds::rep();
+			auto separator = value.find(':');
+			
+			if (separator == std::string_view::npos
+				or std::from_chars(value.data(), value.data() + separator, result.size_) != std::from_chars_result(value.data() + separator, std::errc())
+				or std::from_chars(value.data() + separator + 1, value.data() + value.size(), delay) != std::from_chars_result(value.data() + value.size(), std::errc())
+				or delay < 0)
+			{
+				throw std::runtime_error(std::string("invalid value of ") + std::string(global::env_name_stdin_coalesce) + ", expected <size>:<delay in microseconds>, value is: " + std::string(value));
+			}
+			else if (result.size_ > global::max_byte_string_length)
+			{
+				throw std::runtime_error(std::string("invalid value of ") + std::string(global::env_name_stdin_coalesce) + ", the size must be at most "
+					+ std::to_string(global::max_byte_string_length) + ", value is: " + std::string(value));
+			}
+			
+			result.delay_ = std::chrono::microseconds(delay);
+			return result;
+		}
+	};
+	
+	/// Set only if the standard input is not a terminal
+	std::optional<Stdin_coalescing> stdin_coalescing_;
+	std::experimental::unique_resource<int, void(*)(int)> stdin_timer_;
+	std::uint32_t stdin_timer_events_ = 0;
+	bool stdin_timer_armed_ = false;
+	/// Standard input read but not yet sent
+	std::string input_;
+	
+	/// Outputs of a response recorded for the response cache, see cache.hpp
+	struct Recording
+	{
+		/// The outputs in the order they were received, each as a binary frame
+		std::string outputs_;
+		/// Set when the outputs exceed max_size, the response is then not stored
+		bool overflow_ = false;
+		/// Set when the server marks the response as cacheable
+		bool cacheable_ = false;
+		
+		constexpr static std::size_t max_size = 64 * 1024 * 1024;
+		
+		void append(int fd, std::string_view data)
+		{
+			if (overflow_ or outputs_.size() + frame_header_size + data.size() > max_size)
+			{
+				overflow_ = true;
+				outputs_.clear();
+				return;
+			}
+			
+			outputs_ += char(fd);
+			for (std::size_t i = 0; i != 4; ++i)
+			{
+				outputs_ += char(data.size() >> (8 * i));
+			}
+			outputs_ += data;
+		}
+	};
+	
+	Recording* recording_ = nullptr;
+	
+	/// State shared by the consecutive requests of a batch
+	struct Batch_connection
+	{
+		/// Connection kept after a response if the server has acknowledged the capability 'batch'
+		std::optional<std::experimental::unique_resource<int, void(*)(int)>> socket_;
+		/// Capabilities acknowledged on the kept connection, they are not offered again
+		Capabilities capabilities_;
+		/// Buffer of the deserializer, only kept for its capacity
+		std::string data_;
+	};
+	
+	Batch_connection* batch_connection_ = nullptr;
+	/// The program name in the trace
+	std::string_view program_;
+	
+	/// @param batch_connection Set in batch mode, the request continues the previous one on its connection if it was kept
+	/// @param recording Set if the response is recorded for the response cache
+	Client(const daiyousei::Request& request, Batch_connection* batch_connection = nullptr, Recording* recording = nullptr)
+		:
+		Epoll_client(batch_connection ? std::exchange(batch_connection->socket_, std::nullopt) : std::nullopt),
+		recording_(recording),
+		batch_connection_(batch_connection),
+		program_(request.argv_.empty() ? "" : request.argv_[0])
+	{
+		if (batch_connection_)
+		{
+			data_ = std::move(batch_connection_->data_);
+			fast_exit_ = false;
+		}
+		
+		for (auto& queue : output_queues_)
+		{
+			queue.recording_ = recording_;
+		}
+		
+		if (auto value = size_from_env(global::env_name_max_read_size))
+		{
+			max_read_size_ = *value;
+		}
+		
+		// spliced outputs would bypass the recording
+		if (auto value = size_from_env(global::env_name_splice_threshold); value and not recording_)
+		{
+			enable_splice(*value);
+		}
+		
+		if (auto value = std::getenv(global::env_name_stdin_coalesce.data()); value != nullptr and not isatty(0))
+		{
+			stdin_coalescing_.emplace(Stdin_coalescing::parse(value));
+			
+			auto timer = std::experimental::make_unique_resource_checked(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK), -1, &checked_close);
+			if (timer.get() == -1)
+			{
+				throw std::runtime_error(std::string("failed to create timer file descriptor: ") + std::strerror(errno));
+			}
+			
+			stdin_timer_ = std::move(timer);
+			watch(stdin_timer_.get(), stdin_timer_events_, EPOLLIN);
+		}
+		
+		// a batch sends its environment only once anyway
+		auto argv_prefix = std::size_t(0);
+		if (auto timeout = size_from_env(global::env_name_digests); timeout and not batch_connection_)
+		{
+			argv_prefix = std::min(size_from_env(global::env_name_argv_prefix).value_or(0), request.argv_.size());
+			serialize_digests(request, argv_prefix);
+			send(serializer_.take());
+			wait_for_digests(std::chrono::milliseconds(*timeout));
+		}
+		
+		offered_capabilities_ = Capabilities::all();
+		
+		if (auto value = std::getenv(global::env_name_capabilities.data()))
+		{
+			offered_capabilities_ = Capabilities::parse(value);
+		}
+		
+		// compression is not offered in a batch because its state would have to outlive the request
+		offered_capabilities_.batch_ = offered_capabilities_.batch_ and batch_connection_ != nullptr;
+		offered_capabilities_.deflate_ = offered_capabilities_.deflate_ and batch_connection_ == nullptr;
+		offered_capabilities_.cache_ = offered_capabilities_.cache_ and recording_ != nullptr;
+		
+		if (batch_connection_ and batch_connection_->capabilities_.batch_)
+		{
+			offered_capabilities_ = Capabilities();
+			capabilities_ = batch_connection_->capabilities_;
+		}
+
+#ifdef DAIYOUSEI_ZLIB
+		if (auto value = size_from_env(global::env_name_compression_threshold))
+		{
+			compression_threshold_ = *value;
+		}
+#endif
+
+		serialize_request(request, argv_prefix);
+		
+		// the offered digests may already have been sent
+		request_end_ = statistics_.sent_bytes_ + outbound_size() + serializer_.buffer_.size();
+		send(serializer_.take());
+		
+		// file descriptors can only be passed over Unix sockets,
+		// a batch runs without them because they belong to the current request
+		// and a recorded response must pass through the client
+		if (transport_.domain_ != AF_UNIX or batch_connection_ or recording_)
+		{
+			return;
+		}
+		
+		if (auto timeout = size_from_env(global::env_name_pass_fds))
+		{
+			pass_fds(std::chrono::milliseconds(*timeout), request.cwd_);
+		}
+		else if (auto value = std::getenv(global::env_name_shared_memory.data()))
+		{
+			offer_shared_memory(Shared_memory_options::parse(value));
+		}
+	}
+	
+	/// Stop reading the standard input when this many bytes are waiting to be sent
+	constexpr static std::size_t outbound_high_water_mark = 1024 * 1024;
+	/// Resume reading the standard input when the waiting data shrink below this size
+	constexpr static std::size_t outbound_low_water_mark = 256 * 1024;
+	
+	/// Stop reading the socket when this many bytes are waiting to be written to the standard outputs
+	constexpr static std::size_t output_high_water_mark = 1024 * 1024;
+	/// Resume reading the socket when the waiting outputs shrink below this size
+	constexpr static std::size_t output_low_water_mark = 256 * 1024;
+	
+	/// Data waiting to be sent to the server, starting at outbound_offset_
+	std::string outbound_;
+	std::size_t outbound_offset_ = 0;
+	std::uint32_t socket_events_ = EPOLLIN;
+	std::uint32_t stdin_events_ = stdin_type_ == Stdin_type::pollable ? std::uint32_t(EPOLLIN) : 0;
+	/// Payload bytes of the current standard input chunk yet to be sent from a regular file
+	std::size_t stdin_file_chunk_remaining_ = 0;
+	bool outbound_closed_ = false;
+	bool inbound_paused_ = false;
+	
+	struct Statistics
+	{
+		/// Number of output byte strings received from the server
+		std::size_t output_chunks_ = 0;
+		/// Number of system calls used to write them
+		std::size_t output_writes_ = 0;
+		/// Number of system calls used to read the standard input and the socket
+		std::size_t reads_ = 0;
+		/// Number of standard output bytes moved from the socket by splice(2)
+		std::size_t spliced_bytes_ = 0;
+		/// Number of system calls and io_uring(7) operations which sent data to the server
+		std::size_t sends_ = 0;
+		std::size_t sent_bytes_ = 0;
+		/// Bytes received from the socket, including the spliced ones
+		std::size_t received_bytes_ = 0;
+	}
+	statistics_;
+	
+	/// Number of bytes sent when the request header, up to the standard input, has left the client,
+	/// reset once it has
+	std::optional<std::size_t> request_end_;
+	
+	void count_sent(std::size_t bytes) noexcept
+	{
+		++statistics_.sends_;
+		statistics_.sent_bytes_ += bytes;
+		
+		if (request_end_ and statistics_.sent_bytes_ >= *request_end_)
+		{
+			DAIYOUSEI_PROBE(request_sent, *request_end_);
+			
+			if (trace_)
+			{
+				trace_->mark(Trace::Phase::request_sent);
+			}
+			
+			request_end_.reset();
+		}
+	}
+	
+	void count_received(std::size_t bytes) noexcept
+	{
+		statistics_.received_bytes_ += bytes;
+		
+		if (trace_ and bytes != 0)
+		{
+			trace_->mark(Trace::Phase::first_byte);
+		}
+	}
+	
+	/// Reads from the socket into the data of the deserializer
+	/// @return The number of bytes read, 0 if the server has closed the connection or no data are available
+	std::size_t read_socket()
+	{
+		auto result = transport_.type_ == SOCK_SEQPACKET ? read_messages(socket_.get(), data_) : read_into(socket_.get(), data_);
+		count_received(result);
+		return result;
+	}
+	
+	/// Parses the received data
+	void parse_received()
+	{
+		if (trace_)
+		{
+			trace_->parsing(data_.size());
+		}
+		
+		DAIYOUSEI_PROBE(receive_entry, data_.size());
+		receive();
+		DAIYOUSEI_PROBE(receive_return, data_.size());
+		
+		if (trace_ and exitcode_)
+		{
+			trace_->mark(Trace::Phase::exit_code);
+		}
+		
+		if (trace_ and communication_status_ == Communication_status::terminated)
+		{
+			trace_->mark(Trace::Phase::end_of_list);
+		}
+	}
+	
+	/// Standard output byte strings of at least this length are moved from the socket
+	/// to the standard output by the kernel without being read by the client
+	std::optional<std::size_t> splice_threshold_;
+	/// Intermediate pipe, splice(2) requires one of its ends to be a pipe
+	std::array<std::experimental::unique_resource<int, void(*)(int)>, 2> splice_pipe_;
+	/// Remaining length of the byte string being spliced, not yet moved from the socket
+	std::size_t splice_remaining_ = 0;
+	/// Bytes in the intermediate pipe not yet moved to the standard output
+	std::size_t splice_buffered_ = 0;
+	
+	/// Enables splicing if the standard output is a pipe or a regular file not opened for appending,
+	/// which splice(2) does not support, otherwise silently uses the regular path
+	void enable_splice(std::size_t threshold)
+	{
+		struct stat stdout_stat;
+		
+		if (transport_.type_ != SOCK_STREAM or fstat(1, &stdout_stat) or not (S_ISFIFO(stdout_stat.st_mode)
+			or (S_ISREG(stdout_stat.st_mode) and not (stdio_flags_[1].get().second & O_APPEND))))
+		{
+			return;
+		}
+		
+		auto fds = std::array<int, 2>();
+		if (pipe2(fds.data(), O_NONBLOCK | O_CLOEXEC))
+		{
+			throw std::runtime_error(std::string("failed to create a pipe: ") + std::strerror(errno));
+		}
+		
+		splice_pipe_[0] = std::experimental::unique_resource(fds[0], &checked_close);
+		splice_pipe_[1] = std::experimental::unique_resource(fds[1], &checked_close);
+		splice_threshold_ = threshold;
+	}
+	
+	bool splicing() const noexcept
+	{
+		return splice_remaining_ != 0 or splice_buffered_ != 0;
+	}
+	
+	/// Called after receiving data from the socket, starts splicing if a long enough
+	/// standard output byte string is pending, its buffered prefix is written normally
+	void try_start_splice()
+	{
+		if (not splice_threshold_)
+		{
+			return;
+		}
+		
+		if (frame_fd_ == 1 and not frame_compressed_ and pending_foreign_data_length() >= *splice_threshold_)
+		{
+			// the received prefix of the frame payload was already visited
+			splice_remaining_ = pending_foreign_data_length();
+		}
+		else if (auto length = last_key_ == "stdout" ? pending_byte_string_length() : std::nullopt; length and *length >= *splice_threshold_)
+		{
+			outputs_[0]->push(1, data_);
+			splice_remaining_ = *length - data_.size();
+			skip_byte_string_payload(data_.size());
+		}
+	}
+	
+	/// Moves the pending standard output byte string from the socket through the intermediate pipe,
+	/// the pipe is only filled when empty so that EAGAIN from the socket means there are no data
+	/// @return False if the server has closed the connection
+	bool splice_stdout()
+	{
+		while (splicing() and outputs_[0]->size() == 0)
+		{
+			if (splice_buffered_ != 0)
+			{
+				auto result = splice(splice_pipe_[0].get(), nullptr, 1, nullptr, splice_buffered_, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+				
+				if (result == -1)
+				{
+					if (errno == EWOULDBLOCK or errno == EAGAIN)
+					{
+						return true;
+					}
+					
+					throw std::runtime_error(std::string("writing to stdout failed: ") + std::strerror(errno));
+				}
+				
+				splice_buffered_ -= result;
+				statistics_.spliced_bytes_ += result;
+				continue;
+			}
+			
+			auto result = splice(socket_.get(), nullptr, splice_pipe_[1].get(), nullptr, splice_remaining_, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			++statistics_.reads_;
+			
+			if (result == -1)
+			{
+				if (errno == EWOULDBLOCK or errno == EAGAIN)
+				{
+					return true;
+				}
+				
+				throw std::runtime_error(std::string("read from file descriptor '" + std::to_string(socket_.get()) + "' failed: " + std::strerror(errno)));
+			}
+			else if (result == 0)
+			{
+				return false;
+			}
+			
+			count_received(result);
+			splice_remaining_ -= result;
+			splice_buffered_ += result;
+			
+			if (pending_foreign_data_length() != 0)
+			{
+				skip_foreign_data(result);
+			}
+			else
+			{
+				skip_byte_string_payload(result);
+			}
+			
+			if (splice_remaining_ == 0)
+			{
+				// visits the empty rest of the byte string
+				parse_received();
+			}
+		}
+		
+		return true;
+	}
+	
+	bool statistics_enabled_ = std::getenv(global::env_name_statistics.data()) != nullptr;
+	/// Set if the client does not wait for the end of the response once it has received the exit code,
+	/// a batch always waits because the connection carries the next request
+	bool fast_exit_ = std::getenv(global::env_name_fast_exit.data()) != nullptr;
+	
+	/// Data received from the server waiting to be written to the standard output streams,
+	/// chunks received in one batch are written using a single system call per stream
+	struct Output_queue
+	{
+		struct Chunk
+		{
+			int fd_;
+			std::string data_;
+		};
+		
+		std::deque<Chunk> chunks_;
+		Recording* recording_ = nullptr;
+		/// Already written part of the first chunk
+		std::size_t offset_ = 0;
+		std::size_t size_ = 0;
+		/// Buffers of written chunks kept to avoid reallocation
+		std::vector<std::string> spare_;
+		constexpr static std::size_t max_spare_buffers = 16;
+		
+		std::size_t size() const noexcept
+		{
+			return size_;
+		}
+		
+		int front_fd() const noexcept
+		{
+			return chunks_.front().fd_;
+		}
+		
+		void push(int fd, std::string_view data)
+		{
+			if (data.empty())
+			{
+				return;
+			}
+			
+			if (recording_)
+			{
+				recording_->append(fd, data);
+			}
+			
+			auto buffer = std::string();
+			if (not spare_.empty())
+			{
+				buffer = std::move(spare_.back());
+				spare_.pop_back();
+			}
+			buffer.assign(data);
+			
+			chunks_.emplace_back(fd, std::move(buffer));
+			size_ += data.size();
+		}
+		
+		/// Fills @p iov with the unwritten consecutive chunks for the file descriptor of the first chunk
+		/// @return The number of filled entries and their total length
+		std::pair<std::size_t, std::size_t> gather(std::span<iovec> iov)
+		{
+			auto fd = front_fd();
+			auto count = std::size_t(0);
+			auto total = std::size_t(0);
+			
+			for (auto it = chunks_.begin(); it != chunks_.end() and it->fd_ == fd and count != iov.size(); ++it, ++count)
+			{
+				auto skip = count == 0 ? offset_ : 0;
+				iov[count].iov_base = it->data_.data() + skip;
+				iov[count].iov_len = it->data_.size() - skip;
+				total += iov[count].iov_len;
+			}
+			
+			return {count, total};
+		}
+		
+		/// Writes the chunks in order, consecutive chunks for the same file descriptor are gathered
+		/// @return Whether everything was written
+		bool flush(Statistics& statistics)
+		{
+			auto iov = std::array<iovec, 64>();
+			
+			while (not chunks_.empty())
+			{
+				auto fd = front_fd();
+				auto [count, total] = gather(iov);
+				auto result = writev(fd, iov.data(), count);
+				
+				if (result == -1)
+				{
+					if (errno == EWOULDBLOCK or errno == EAGAIN)
+					{
+						return false;
+					}
+					
+					throw std::runtime_error(std::string("writing to ") + (fd == 1 ? "stdout" : "stderr") + " failed: " + std::strerror(errno));
+				}
+				
+				++statistics.output_writes_;
+				consume(result);
+				
+				if (std::size_t(result) != total)
+				{
+					return false;
+				}
+			}
+			
+			return true;
+		}
+		
+		/// Releases the first @p length bytes which were written
+		void consume(std::size_t length)
+		{
+			size_ -= length;
+			
+			while (length != 0)
+			{
+				auto& front = chunks_.front().data_;
+				
+				if (auto remaining = front.size() - offset_; length >= remaining)
+				{
+					length -= remaining;
+					offset_ = 0;
+					
+					if (spare_.size() < max_spare_buffers)
+					{
+						front.clear();
+						spare_.push_back(std::move(front));
+					}
+					
+					chunks_.pop_front();
+				}
+				else
+				{
+					offset_ += length;
+					length = 0;
+				}
+			}
+		}
+	};
+	
+	/// When the standard output and error streams refer to the same file,
+	/// both use the same queue in order to keep their relative order
+	std::array<Output_queue, 2> output_queues_;
+	std::array<Output_queue*, 2> outputs_ = [this]
+	{
+		struct stat stdout_stat;
+		struct stat stderr_stat;
+		
+		if (fstat(1, &stdout_stat) == 0 and fstat(2, &stderr_stat) == 0
+			and stdout_stat.st_dev == stderr_stat.st_dev and stdout_stat.st_ino == stderr_stat.st_ino)
+		{
+			return std::array<Output_queue*, 2> {&output_queues_[0], &output_queues_[0]};
+		}
+		
+		return std::array<Output_queue*, 2> {&output_queues_[0], &output_queues_[1]};
+	}();
+	std::array<std::uint32_t, 2> output_events_ = {};
+	
+	std::size_t outbound_size() const noexcept
+	{
+		return outbound_.size() - outbound_offset_;
+	}
+	
+	std::size_t output_size() const noexcept
+	{
+		return output_queues_[0].size() + output_queues_[1].size();
+	}
+	
+	/// Flushes the queues which are waiting for @p fd, or all queues
+	void flush_outputs(int fd = -1)
+	{
+		for (auto& queue : output_queues_)
+		{
+			if (queue.size() != 0 and (fd == -1 or queue.front_fd() == fd))
+			{
+				queue.flush(statistics_);
+			}
+		}
+	}
+	
+	/// @return The number of bytes sent, possibly 0 if the socket buffer is full
+	/// @param fds File descriptors passed along with the first byte
+	std::size_t send_some(std::span<const std::string_view> parts, std::span<const int> fds = {})
+	{
+		auto iov = std::array<iovec, 4>();
+		auto message = msghdr();
+		message.msg_iov = iov.data();
+		message.msg_iovlen = parts.size();
+		
+		for (std::size_t i = 0; i != parts.size(); ++i)
+		{
+			iov[i].iov_base = const_cast<char*>(parts[i].data());
+			iov[i].iov_len = parts[i].size();
+		}
+		
+		alignas(cmsghdr) auto control = std::array<char, CMSG_SPACE(sizeof(int) * max_passed_fds)>();
+		
+		if (not fds.empty())
+		{
+			message.msg_control = control.data();
+			message.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+			auto header = CMSG_FIRSTHDR(&message);
+			header->cmsg_level = SOL_SOCKET;
+			header->cmsg_type = SCM_RIGHTS;
+			header->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+			std::memcpy(CMSG_DATA(header), fds.data(), sizeof(int) * fds.size());
+		}
+		
+		if (auto result = ::sendmsg(socket_.get(), &message, MSG_NOSIGNAL); result != -1)
+		{
+			count_sent(result);
+			return result;
+		}
+		else if (errno == EWOULDBLOCK or errno == EAGAIN)
+		{
+			return 0;
+		}
+		else
+		{
+			throw std::runtime_error(std::string("failed to send message: ") + std::strerror(errno));
+		}
+	}
+	
+	/// Sends the concatenation of @p parts, as much as possible directly from the
+	/// parts themselves, and queues the rest
+	void send(std::initializer_list<std::string_view> parts) override
+	{
+		auto sent = std::size_t(0);
+		check_message_size(std::accumulate(parts.begin(), parts.end(), std::size_t(0), [](std::size_t size, std::string_view part) -> std::size_t
+		{
+			return size + part.size();
+		}));
+		
+		if (outbound_size() == 0 and not uses_uring())
+		{
+			sent = send_some(parts);
+		}
+		
+		for (auto part : parts)
+		{
+			auto skip = std::min(sent, part.size());
+			sent -= skip;
+			outbound_ += part.substr(skip);
+		}
+		
+		mark_message_end();
+		update_events();
+	}
+	
+	void send(std::string_view data)
+	{
+		send({data});
+	}
+	
+	/// Sends @p data with @p fds attached to its first byte
+	void send(std::string_view data, std::span<const int> fds)
+	{
+		auto sent = std::size_t(0);
+		check_message_size(data.size());
+		
+		if (outbound_size() == 0 and not uses_uring())
+		{
+			sent = send_some(std::span(&data, 1), fds);
+		}
+		
+		if (sent == 0)
+		{
+			outbound_fds_.assign(fds.begin(), fds.end());
+			outbound_fds_position_ = outbound_.size();
+		}
+		
+		outbound_ += data.substr(sent);
+		mark_message_end();
+		update_events();
+	}
+	
+	/// Positions in the outbound queue where the messages end, only used if the socket preserves message boundaries
+	std::deque<std::size_t> outbound_message_ends_;
+	
+	void check_message_size(std::size_t size) const
+	{
+		if (size > max_message_size_)
+		{
+			throw std::runtime_error("message of " + std::to_string(size) + " bytes is longer than the maximum of "
+				+ std::to_string(max_message_size_) + " bytes for " + transport_.name_);
+		}
+	}
+	
+	void mark_message_end()
+	{
+		if (transport_.type_ == SOCK_SEQPACKET and outbound_size() != 0
+			and (outbound_message_ends_.empty() or outbound_message_ends_.back() != outbound_.size()))
+		{
+			outbound_message_ends_.push_back(outbound_.size());
+		}
+	}
+	
+	void flush_outbound()
+	{
+		auto data = std::string_view(outbound_).substr(outbound_offset_);
+		auto fds = std::span<const int>();
+		
+		if (not outbound_fds_.empty() and outbound_offset_ != outbound_fds_position_)
+		{
+			// the file descriptors must be attached to their byte
+			data = data.substr(0, outbound_fds_position_ - outbound_offset_);
+		}
+		else if (not outbound_fds_.empty())
+		{
+			fds = outbound_fds_;
+		}
+		
+		if (transport_.type_ == SOCK_SEQPACKET)
+		{
+			// as many whole queued messages as fit in a single one
+			auto length = std::size_t(0);
+			for (auto end : outbound_message_ends_)
+			{
+				if (end - outbound_offset_ > std::min(data.size(), max_message_size_))
+				{
+					break;
+				}
+				
+				length = end - outbound_offset_;
+			}
+			
+			data = data.substr(0, length);
+		}
+		
+		if (auto sent = send_some(std::span(&data, 1), fds); sent != 0)
+		{
+			outbound_offset_ += sent;
+			
+			if (not fds.empty())
+			{
+				outbound_fds_.clear();
+			}
+		}
+		
+		while (not outbound_message_ends_.empty() and outbound_message_ends_.front() <= outbound_offset_)
+		{
+			outbound_message_ends_.pop_front();
+		}
+		
+		if (outbound_offset_ == outbound_.size())
+		{
+			outbound_.clear();
+			outbound_offset_ = 0;
+		}
+		else if (outbound_offset_ >= outbound_.size() / 2)
+		{
+			outbound_.erase(0, outbound_offset_);
+			outbound_fds_position_ -= std::min(outbound_fds_position_, outbound_offset_);
+			
+			for (auto& end : outbound_message_ends_)
+			{
+				end -= outbound_offset_;
+			}
+			
+			outbound_offset_ = 0;
+		}
+		
+		update_events();
+	}
+	
+	Negotiation fd_passing_ = Negotiation::disabled;
+	Negotiation shared_memory_ = Negotiation::disabled;
+	
+	constexpr static std::size_t max_passed_fds = 4;
+	std::chrono::steady_clock::time_point acknowledgement_deadline_;
+	
+	/// Waits until the server answers which of the offered digests it knows, the parts it does not know
+	/// are sent whole as if the digests were not offered
+	void wait_for_digests(std::chrono::milliseconds timeout)
+	{
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		
+		while (digests_ == Negotiation::pending)
+		{
+			auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+			if (remaining.count() <= 0)
+			{
+				break;
+			}
+			
+			auto descriptor = pollfd {.fd = socket_.get(), .events = short(POLLIN | (outbound_size() == 0 ? 0 : POLLOUT)), .revents = 0};
+			if (poll(&descriptor, 1, int(remaining.count())) == -1)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				
+				throw std::runtime_error(std::string("failed to wait for the digests to be acknowledged: ") + std::strerror(errno));
+			}
+			
+			if (descriptor.revents & POLLOUT)
+			{
+				flush_outbound();
+			}
+			
+			if (descriptor.revents & ~POLLOUT)
+			{
+				auto read_result = read_socket();
+				parse_received();
+				
+				if (read_result == 0)
+				{
+					break;
+				}
+			}
+		}
+		
+		if (digests_ == Negotiation::pending)
+		{
+			digests_ = Negotiation::rejected;
+		}
+	}
+	
+	/// While an offered feature is not acknowledged, the standard input is not read
+	bool awaiting_acknowledgement() const noexcept
+	{
+		return fd_passing_ == Negotiation::pending or shared_memory_ == Negotiation::pending;
+	}
+	
+	bool acknowledgement_pending(std::string_view key) const noexcept override
+	{
+		return (key == "fds" and fd_passing_ == Negotiation::pending) or (key == "shm" and shared_memory_ == Negotiation::pending);
+	}
+	
+	bool acknowledge(std::string_view key, bool accepted) override
+	{
+		if (key == "fds" and accepted)
+		{
+			accept_fd_passing();
+		}
+		else if (key == "fds")
+		{
+			reject_fd_passing();
+		}
+		else if (key == "shm" and accepted)
+		{
+			accept_shared_memory();
+		}
+		else if (key == "shm")
+		{
+			reject_shared_memory();
+		}
+		else
+		{
+			return false;
+		}
+		
+		return true;
+	}
+	
+	void reject_pending() override
+	{
+		Session::reject_pending();
+		
+		if (fd_passing_ == Negotiation::pending)
+		{
+			reject_fd_passing();
+		}
+		
+		if (shared_memory_ == Negotiation::pending)
+		{
+			reject_shared_memory();
+		}
+	}
+	
+	/// File descriptors to be attached to the byte at outbound_fds_position_ of the outbound queue
+	std::vector<int> outbound_fds_;
+	std::size_t outbound_fds_position_ = 0;
+	/// Opened with O_PATH, kept open until it is sent
+	std::experimental::unique_resource<int, void(*)(int)> passed_cwd_;
+	
+	/// Sends the standard streams and the working directory @p directory to the server, then waits for acknowledgement,
+	/// the standard streams are switched back to their original blocking mode because the server shares them
+	void pass_fds(std::chrono::milliseconds timeout, std::string_view directory)
+	{
+		auto cwd = std::experimental::make_unique_resource_checked(open(std::string(directory).c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC), -1, &checked_close);
+		if (cwd.get() == -1)
+		{
+			throw std::runtime_error(std::string("failed to open the working directory ") + std::string(directory) + ": " + std::strerror(errno));
+		}
+		passed_cwd_ = std::move(cwd);
+		
+		for (auto it = stdio_flags_.rbegin(); it != stdio_flags_.rend(); ++it)
+		{
+			it->reset();
+		}
+		
+		fd_passing_ = Negotiation::pending;
+		acknowledgement_deadline_ = std::chrono::steady_clock::now() + timeout;
+		watch(0, stdin_events_, 0);
+		
+		auto fds = std::array<int, max_passed_fds>{0, 1, 2, passed_cwd_.get()};
+		send("3:fds", fds);
+		send("l5:stdin6:stdout6:stderr3:cwde");
+	}
+	
+	void accept_fd_passing()
+	{
+		fd_passing_ = Negotiation::accepted;
+		close_stdin();
+	}
+	
+	void reject_fd_passing()
+	{
+		fd_passing_ = Negotiation::rejected;
+		
+		stdio_flags_[0] = set_nonblocking(0, "standard input stream");
+		stdio_flags_[1] = set_nonblocking(1, "standard output stream");
+		stdio_flags_[2] = set_nonblocking(2, "standard error stream");
+		
+		update_events();
+	}
+	
+	struct Shared_memory_options
+	{
+		std::size_t ring_size_;
+		std::chrono::milliseconds timeout_;
+		
+		/// Parses the value in the format <ring size>:<timeout in milliseconds>
+		static Shared_memory_options parse(std::string_view value)
+		{
+			auto result = Shared_memory_options();
+			auto timeout = std::chrono::milliseconds::rep();
+			auto separator = value.find(':');
+			
+			if (separator == std::string_view::npos
+				or std::from_chars(value.data(), value.data() + separator, result.ring_size_) != std::from_chars_result(value.data() + separator, std::errc())
+				or std::from_chars(value.data() + separator + 1, value.data() + value.size(), timeout) != std::from_chars_result(value.data() + value.size(), std::errc())
+				or timeout < 0 or not shared_memory::is_valid_ring_size(result.ring_size_))
+			{
+				throw std::runtime_error(std::string("invalid value of ") + std::string(global::env_name_shared_memory)
+					+ ", expected <ring size>:<timeout in milliseconds> where the ring size is a power of two of at least 4096, value is: " + std::string(value));
+			}
+			
+			result.timeout_ = std::chrono::milliseconds(timeout);
+			return result;
+		}
+	};
+	
+	/// Memory file shared with the server containing the standard input ring and the output ring,
+	/// each side wakes up the other one using its event file descriptor
+	struct Shared_rings
+	{
+		std::experimental::unique_resource<int, void(*)(int)> file_;
+		std::experimental::unique_resource<std::span<char>, void(*)(std::span<char>)> mapping_;
+		std::experimental::unique_resource<int, void(*)(int)> client_event_;
+		std::experimental::unique_resource<int, void(*)(int)> server_event_;
+		std::uint32_t client_event_events_ = 0;
+		shared_memory::Ring stdin_;
+		shared_memory::Ring output_;
+		/// Output file descriptor and the remaining payload of the output record being read
+		std::uint32_t record_fd_ = 0;
+		std::size_t record_remaining_ = 0;
+		
+		static void unmap(std::span<char> mapping)
+		{
+			if (munmap(mapping.data(), mapping.size()) == -1)
+			{
+				global::report({"munmap failed: ", std::strerror(errno)});
+			}
+		}
+		
+		static std::experimental::unique_resource<int, void(*)(int)> create_file(std::size_t size)
+		{
+			auto file = std::experimental::make_unique_resource_checked(memfd_create("daiyousei", MFD_CLOEXEC), -1, &checked_close);
+			if (file.get() == -1)
+			{
+				throw std::runtime_error(std::string("failed to create shared memory file: ") + std::strerror(errno));
+			}
+			
+			if (ftruncate(file.get(), size) == -1)
+			{
+				throw std::runtime_error(std::string("failed to resize shared memory file: ") + std::strerror(errno));
+			}
+			
+			return file;
+		}
+		
+		static std::span<char> map(int fd, std::size_t size)
+		{
+			auto mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (mapping == MAP_FAILED)
+			{
+				throw std::runtime_error(std::string("failed to map shared memory file: ") + std::strerror(errno));
+			}
+			
+			return std::span(static_cast<char*>(mapping), size);
+		}
+		
+		static std::experimental::unique_resource<int, void(*)(int)> create_event()
+		{
+			auto event = std::experimental::make_unique_resource_checked(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), -1, &checked_close);
+			if (event.get() == -1)
+			{
+				throw std::runtime_error(std::string("failed to create event file descriptor: ") + std::strerror(errno));
+			}
+			
+			return event;
+		}
+		
+		Shared_rings(std::size_t ring_size)
+			:
+			file_(create_file(shared_memory::file_size(ring_size))),
+			mapping_(map(file_.get(), shared_memory::file_size(ring_size)), &unmap),
+			client_event_(create_event()),
+			server_event_(create_event()),
+			stdin_(mapping_.get().data(), shared_memory::offset::stdin_head, shared_memory::offset::stdin_tail,
+				shared_memory::offset::data, ring_size),
+			output_(mapping_.get().data(), shared_memory::offset::output_head, shared_memory::offset::output_tail,
+				shared_memory::offset::data + ring_size, ring_size)
+		{
+		}
+		
+		std::atomic_ref<std::uint32_t> client_waiting() noexcept
+		{
+			return shared_memory::flag(mapping_.get().data(), shared_memory::offset::client_waiting);
+		}
+		
+		/// Wakes up the server if it waits for the rings to change
+		void wake_server()
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			
+			if (shared_memory::flag(mapping_.get().data(), shared_memory::offset::server_waiting).exchange(0) != 0
+				and eventfd_write(server_event_.get(), 1) == -1)
+			{
+				throw std::runtime_error(std::string("failed to wake up the server: ") + std::strerror(errno));
+			}
+		}
+	};
+	
+	std::optional<Shared_rings> shared_rings_;
+	
+	/// Offers the server to exchange the standard streams through rings in shared memory,
+	/// the bencode list then only carries the other values
+	void offer_shared_memory(const Shared_memory_options& options)
+	{
+		auto& rings = shared_rings_.emplace(options.ring_size_);
+		
+		shared_memory_ = Negotiation::pending;
+		acknowledgement_deadline_ = std::chrono::steady_clock::now() + options.timeout_;
+		watch(0, stdin_events_, 0);
+		
+		auto fds = std::array<int, 3>{rings.file_.get(), rings.client_event_.get(), rings.server_event_.get()};
+		send("3:shm", fds);
+		serializer_.push_integer(bencode::Integer(options.ring_size_));
+		send(serializer_.take());
+	}
+	
+	void accept_shared_memory()
+	{
+		shared_memory_ = Negotiation::accepted;
+		watch(shared_rings_->client_event_.get(), shared_rings_->client_event_events_, EPOLLIN);
+		update_events();
+	}
+	
+	void reject_shared_memory()
+	{
+		shared_memory_ = Negotiation::rejected;
+		shared_rings_.reset();
+		update_events();
+	}
+	
+	/// Moves the records from the output ring to the output queues until they are full
+	void receive_ring_output()
+	{
+		auto& rings = *shared_rings_;
+		bool consumed = false;
+		
+		while (output_size() <= output_high_water_mark)
+		{
+			if (rings.record_remaining_ == 0)
+			{
+				if (rings.output_.readable() < shared_memory::record_header_size)
+				{
+					break;
+				}
+				
+				auto header = std::array<char, shared_memory::record_header_size>();
+				rings.output_.peek(header);
+				rings.output_.consume(header.size());
+				consumed = true;
+				
+				auto length = std::uint32_t();
+				std::memcpy(&rings.record_fd_, header.data(), sizeof(rings.record_fd_));
+				std::memcpy(&length, header.data() + sizeof(rings.record_fd_), sizeof(length));
+				rings.record_remaining_ = length;
+				
+				if (rings.record_fd_ != 1 and rings.record_fd_ != 2)
+				{
+					throw std::runtime_error("invalid file descriptor in the shared memory output ring: " + std::to_string(rings.record_fd_));
+				}
+				
+				continue;
+			}
+			
+			auto data = rings.output_.readable_spans()[0];
+			
+			if (data.empty())
+			{
+				break;
+			}
+			
+			data = data.first(std::min(data.size(), rings.record_remaining_));
+			outputs_[rings.record_fd_ - 1]->push(rings.record_fd_, std::string_view(data.data(), data.size()));
+			++statistics_.output_chunks_;
+			rings.output_.consume(data.size());
+			rings.record_remaining_ -= data.size();
+			consumed = true;
+		}
+		
+		if (consumed)
+		{
+			rings.wake_server();
+		}
+	}
+	
+	void receive_stdin_ring()
+	{
+		auto spans = shared_rings_->stdin_.writable_spans();
+		auto iov = std::array<iovec, 2>();
+		
+		for (std::size_t i = 0; i != spans.size(); ++i)
+		{
+			iov[i].iov_base = spans[i].data();
+			iov[i].iov_len = spans[i].size();
+		}
+		
+		if (iov[0].iov_len == 0)
+		{
+			// the ring is full until the server consumes it
+			update_events();
+			return;
+		}
+		
+		if (auto result = readv(0, iov.data(), iov[1].iov_len == 0 ? 1 : 2); result > 0)
+		{
+			++statistics_.reads_;
+			DAIYOUSEI_PROBE(stdin_chunk, result, 0);
+			shared_rings_->stdin_.produce(result);
+			shared_rings_->wake_server();
+		}
+		else if (result == 0)
+		{
+			close_stdin();
+		}
+		else if (errno != EWOULDBLOCK and errno != EAGAIN)
+		{
+			throw std::runtime_error(std::string("read from file descriptor '0' failed: ") + std::strerror(errno));
+		}
+		
+		update_events();
+	}
+	
+	/// Adjusts the watched events according to the amount of queued data in both directions
+	void update_events()
+	{
+		if (uses_uring())
+		{
+			// the io_uring(7) loop submits the operations itself
+			return;
+		}
+		
+		// the end of the request list suffices if the connection may carry the next request of a batch
+		if (stdin_closed_ and outbound_size() == 0 and not outbound_closed_ and not offered_capabilities_.batch_ and not capabilities_.batch_)
+		{
+			outbound_closed_ = true;
+			
+			if (auto result = shutdown(socket_.get(), SHUT_WR); result == -1)
+			{
+				global::report({"socket shutdown failed: ", std::strerror(errno)});
+			}
+		}
+		
+		if (not inbound_paused_ and output_size() > output_high_water_mark)
+		{
+			inbound_paused_ = true;
+		}
+		else if (inbound_paused_ and output_size() < output_low_water_mark)
+		{
+			inbound_paused_ = false;
+		}
+		
+		// the queued output preceding the spliced data and the intermediate pipe need to be written first
+		bool splice_waiting = splicing() and (outputs_[0]->size() != 0 or splice_buffered_ != 0);
+		
+		// the socket is always writable after sendfile(2) until it fails with EAGAIN
+		bool stdin_file_pending = stdin_type_ == Stdin_type::regular_file and not stdin_closed_ and not awaiting_acknowledgement()
+			and shared_memory_ != Negotiation::accepted;
+		
+		watch(socket_.get(), socket_events_, (inbound_paused_ or splice_waiting ? 0 : std::uint32_t(EPOLLIN))
+			| (outbound_size() == 0 and not stdin_file_pending ? 0 : std::uint32_t(EPOLLOUT))
+		);
+		
+		update_stdin_events();
+		update_output_events();
+	}
+	
+	void update_stdin_events()
+	{
+		if (stdin_closed_ or stdin_type_ != Stdin_type::pollable or awaiting_acknowledgement())
+		{
+			return;
+		}
+		
+		if (shared_memory_ == Negotiation::accepted)
+		{
+			watch(0, stdin_events_, shared_rings_->stdin_.writable() == 0 ? 0 : std::uint32_t(EPOLLIN));
+		}
+		else if (stdin_events_ != 0 and outbound_size() > outbound_high_water_mark)
+		{
+			watch(0, stdin_events_, 0);
+		}
+		else if (stdin_events_ == 0 and outbound_size() < outbound_low_water_mark)
+		{
+			watch(0, stdin_events_, EPOLLIN);
+		}
+	}
+	
+	void update_output_events()
+	{
+		auto output_events = std::array<std::uint32_t, 2>();
+		for (auto& queue : output_queues_)
+		{
+			if (queue.size() != 0)
+			{
+				output_events[queue.front_fd() - 1] = EPOLLOUT;
+			}
+		}
+		
+		if (splice_buffered_ != 0)
+		{
+			output_events[0] = EPOLLOUT;
+		}
+		
+		for (int fd = 1; fd != 3; ++fd)
+		{
+			watch(fd, output_events_[fd - 1], output_events[fd - 1]);
+		}
+	}
+	
+	void arm_stdin_timer()
+	{
+		auto seconds = std::chrono::duration_cast<std::chrono::seconds>(stdin_coalescing_->delay_);
+		auto value = itimerspec();
+		value.it_value.tv_sec = seconds.count();
+		value.it_value.tv_nsec = std::chrono::nanoseconds(stdin_coalescing_->delay_ - seconds).count();
+		
+		if (value.it_value.tv_sec == 0 and value.it_value.tv_nsec == 0)
+		{
+			// a zero value would disarm the timer
+			value.it_value.tv_nsec = 1;
+		}
+		
+		if (timerfd_settime(stdin_timer_.get(), 0, &value, nullptr))
+		{
+			throw std::runtime_error(std::string("failed to arm timer: ") + std::strerror(errno));
+		}
+		
+		stdin_timer_armed_ = true;
+	}
+	
+	/// Sends the collected standard input, if any
+	void send_stdin()
+	{
+		if (stdin_timer_armed_)
+		{
+			auto value = itimerspec();
+			if (timerfd_settime(stdin_timer_.get(), 0, &value, nullptr))
+			{
+				throw std::runtime_error(std::string("failed to disarm timer: ") + std::strerror(errno));
+			}
+			
+			stdin_timer_armed_ = false;
+		}
+		
+		if (input_.empty())
+		{
+			return;
+		}
+		
+		send_stdin_chunks(input_, max_message_size_);
+		input_.clear();
+	}
+	
+	/// Sends standard input which is a regular file using sendfile(2) until the socket is full,
+	/// the file is sent in byte strings of the maximum length the client itself accepts
+	void send_stdin_file()
+	{
+		while (not stdin_closed_ and outbound_size() == 0 and not awaiting_acknowledgement()
+			and shared_memory_ != Negotiation::accepted)
+		{
+			if (stdin_file_chunk_remaining_ == 0)
+			{
+				struct stat stdin_stat;
+				if (fstat(0, &stdin_stat))
+				{
+					throw std::runtime_error(std::string("failed to inspect the standard input stream: ") + std::strerror(errno));
+				}
+				
+				auto offset = lseek(0, 0, SEEK_CUR);
+				if (offset == -1)
+				{
+					throw std::runtime_error(std::string("failed to get the position of the standard input stream: ") + std::strerror(errno));
+				}
+				
+				if (offset >= stdin_stat.st_size)
+				{
+					close_stdin();
+					return;
+				}
+				
+				stdin_file_chunk_remaining_ = std::min(std::size_t(stdin_stat.st_size - offset),
+					capabilities_.frames_ ? max_frame_length : global::max_byte_string_length);
+				
+				auto header = std::array<char, max_stdin_header_length>();
+				DAIYOUSEI_PROBE(stdin_chunk, stdin_file_chunk_remaining_, 0);
+				send(stdin_header(header, stdin_file_chunk_remaining_));
+				continue;
+			}
+			
+			if (auto result = sendfile(socket_.get(), 0, nullptr, stdin_file_chunk_remaining_); result > 0)
+			{
+				count_sent(result);
+				stdin_file_chunk_remaining_ -= result;
+			}
+			else if (result == 0)
+			{
+				throw std::runtime_error(std::string("the standard input file was truncated while being sent"));
+			}
+			else if (errno == EWOULDBLOCK or errno == EAGAIN)
+			{
+				return;
+			}
+			else
+			{
+				throw std::runtime_error(std::string("failed to send the standard input file: ") + std::strerror(errno));
+			}
+		}
+	}
+	
+	/// Reads the standard input when it is ready and sends it or collects it according to the coalescing settings
+	void receive_stdin()
+	{
+		if (shared_memory_ == Negotiation::accepted)
+		{
+			receive_stdin_ring();
+		}
+		else if (read_into(0, input_) == 0)
+		{
+			send_stdin();
+			close_stdin();
+		}
+		else if (not stdin_coalescing_ or input_.size() >= stdin_coalescing_->size_)
+		{
+			send_stdin();
+		}
+		else if (not stdin_timer_armed_)
+		{
+			arm_stdin_timer();
+		}
+	}
+	
+	void close_stdin()
+	{
+		watch(0, stdin_events_, 0);
+		Session::close_stdin();
+	}
+	
+	/// Last attempt to tell the server that stdin was closed when the communication ends,
+	/// the end of list is only sent if it does not cut a queued message in half
+	void close_outbound() noexcept
+	{
+		if (outbound_closed_)
+		{
+			return;
+		}
+		
+		if (capabilities_.batch_ and communication_status_ == Communication_status::terminated and finish_request())
+		{
+			outbound_closed_ = true;
+			return;
+		}
+		
+		capabilities_.batch_ = false;
+
+#ifdef DAIYOUSEI_IO_URING
+		// a message which io_uring(7) did not finish sending would be cut in half
+		bool sending = uring_sending_offset_ != uring_sending_.size();
+#else
+		bool sending = false;
+#endif
+
+		// ignore errors, such as EPIPE if the server has already closed the connection
+		if (outbound_size() != 0 and not sending)
+		{
+			if (auto result = ::send(socket_.get(), outbound_.data() + outbound_offset_, outbound_size(), MSG_NOSIGNAL | MSG_DONTWAIT); result > 0)
+			{
+				count_sent(result);
+				outbound_offset_ += result;
+			}
+		}
+		
+		if (outbound_size() == 0 and not sending and not stdin_closed_)
+		{
+			if (::send(socket_.get(), "e", 1, MSG_NOSIGNAL | MSG_DONTWAIT) == 1)
+			{
+				count_sent(1);
+			}
+		}
+		
+		outbound_closed_ = true;
+		
+		if (auto result = shutdown(socket_.get(), SHUT_WR); result == -1)
+		{
+			global::report({"socket shutdown failed: ", std::strerror(errno)});
+		}
+	}
+	
+	/// Sends the rest of the request when the response has ended and the connection is kept for the next request,
+	/// unlike close_outbound it waits until everything is sent because the next request must not be cut off
+	/// @return Whether the whole request was sent before the connect timeout expired
+	bool finish_request() noexcept
+	{
+		try
+		{
+			Session::close_stdin();
+			
+			auto deadline = std::chrono::steady_clock::now() + connect_timeout_;
+			
+			while (outbound_size() != 0)
+			{
+				flush_outbound();
+				
+				if (outbound_size() == 0)
+				{
+					break;
+				}
+				
+				auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+				if (remaining.count() <= 0)
+				{
+					return false;
+				}
+				
+				auto descriptor = pollfd {.fd = socket_.get(), .events = POLLOUT, .revents = 0};
+				if (poll(&descriptor, 1, int(remaining.count())) == -1 and errno != EINTR)
+				{
+					return false;
+				}
+			}
+			
+			return true;
+		}
+		catch (std::exception&)
+		{
+			return false;
+		}
+	}
+	
+	/// Waits until all received output is written
+	void drain_outputs()
+	{
+		auto events = std::array<epoll_event, 2>();
+		
+		watch(0, stdin_events_, 0);
+		watch(socket_.get(), socket_events_, 0);
+		
+		flush_outputs();
+		update_output_events();
+		
+		while (output_size() != 0)
+		{
+			auto ready_events = epoll_wait(epoll_fd_.get(), events.data(), events.size(), -1);
+			for (int i = 0; i != ready_events; ++i)
+			{
+				flush_outputs(events[i].data.fd);
+			}
+			
+			update_output_events();
+		}
+	}
+
+#ifdef DAIYOUSEI_IO_URING
+	/// Operations submitted to io_uring(7), the user data of an entry is the operation
+	/// shifted left by 8 bits combined with the index of the output queue
+	enum struct Uring_operation : std::uint64_t
+	{
+		connect,
+		connect_timeout,
+		send,
+		receive,
+		read_stdin,
+		write_output,
+		poll,
+		shutdown,
+		cancel,
+	};
+	
+	/// Data being sent by io_uring(7), swapped with the outbound queue so that the queue can grow meanwhile
+	std::string uring_sending_;
+	std::size_t uring_sending_offset_ = 0;
+	std::array<std::array<iovec, 64>, 2> uring_output_iov_ = {};
+	std::array<bool, 2> uring_writing_ = {};
+	bool uring_connecting_ = false;
+	/// Read by the kernel when the connection is submitted
+	__kernel_timespec uring_connect_timeout_ {};
+	bool uring_reading_stdin_ = false;
+	bool uring_receiving_ = false;
+	/// Size of the received data before the space for the receive in flight was appended
+	std::size_t uring_received_size_ = 0;
+	bool uring_inbound_closed_ = false;
+	
+	static std::uint64_t uring_data(Uring_operation operation, std::size_t index = 0) noexcept
+	{
+		return std::uint64_t(operation) << 8 | index;
+	}
+	
+	/// Prepares a poll for @p events linked to the following entry, used if a standard stream
+	/// was made non-blocking by another process and the operation failed with EAGAIN
+	void uring_poll_before(int fd, std::uint32_t events)
+	{
+		auto& entry = uring_->prepare(IORING_OP_POLL_ADD, fd, uring_data(Uring_operation::poll));
+		entry.poll32_events = events;
+		entry.flags |= IOSQE_IO_LINK;
+	}
+	
+	void uring_send(std::uint8_t flags = 0)
+	{
+		auto data = std::string_view(uring_sending_).substr(uring_sending_offset_);
+		auto& entry = uring_->prepare(IORING_OP_SEND, socket_.get(), uring_data(Uring_operation::send));
+		entry.addr = reinterpret_cast<std::uint64_t>(data.data());
+		entry.len = data.size();
+		entry.msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+		entry.flags |= flags;
+	}
+	
+	/// Receives directly into the end of the received data, which is not touched until the receive completes,
+	/// a multishot receive into provided buffers would need another copy because the data must be contiguous
+	void uring_receive()
+	{
+		uring_received_size_ = data_.size();
+		data_.resize_and_overwrite(uring_received_size_ + max_read_size_, [](char*, std::size_t size) -> std::size_t
+		{
+			return size;
+		});
+		
+		auto& entry = uring_->prepare(IORING_OP_RECV, socket_.get(), uring_data(Uring_operation::receive));
+		entry.addr = reinterpret_cast<std::uint64_t>(data_.data() + uring_received_size_);
+		entry.len = max_read_size_;
+		uring_receiving_ = true;
+	}
+	
+	/// Truncates the received data to the bytes which the receive actually wrote
+	void uring_received(int result)
+	{
+		data_.resize(uring_received_size_ + std::max(result, 0));
+		uring_receiving_ = false;
+	}
+	
+	void uring_read_stdin(bool after_poll = false)
+	{
+		if (after_poll)
+		{
+			uring_poll_before(0, POLLIN);
+		}
+		
+		auto& entry = uring_->prepare(IORING_OP_READ_FIXED, 0, uring_data(Uring_operation::read_stdin));
+		entry.addr = reinterpret_cast<std::uint64_t>(uring_->fixed_buffer_.data());
+		entry.len = std::min(max_read_size_, uring_->fixed_buffer_.size());
+		// from the current file position
+		entry.off = std::uint64_t(-1);
+		entry.buf_index = 0;
+		uring_reading_stdin_ = true;
+	}
+	
+	void uring_write_output(std::size_t index, bool after_poll = false)
+	{
+		auto& queue = output_queues_[index];
+		auto [count, total] = queue.gather(uring_output_iov_[index]);
+		
+		if (after_poll)
+		{
+			uring_poll_before(queue.front_fd(), POLLOUT);
+		}
+		
+		auto& entry = uring_->prepare(IORING_OP_WRITEV, queue.front_fd(), uring_data(Uring_operation::write_output, index));
+		entry.addr = reinterpret_cast<std::uint64_t>(uring_output_iov_[index].data());
+		entry.len = count;
+		entry.off = std::uint64_t(-1);
+		uring_writing_[index] = true;
+	}
+	
+	/// Sends the queued data, or shuts the socket down after the last of them, once it is connected
+	void uring_prepare_send()
+	{
+		if (uring_connecting_)
+		{
+			return;
+		}
+		
+		if (uring_sending_offset_ == uring_sending_.size() and outbound_size() != 0)
+		{
+			std::swap(uring_sending_, outbound_);
+			uring_sending_offset_ = std::exchange(outbound_offset_, 0);
+			outbound_.clear();
+			uring_send();
+		}
+		else if (stdin_closed_ and uring_sending_offset_ == uring_sending_.size() and outbound_size() == 0 and not outbound_closed_)
+		{
+			outbound_closed_ = true;
+			auto& entry = uring_->prepare(IORING_OP_SHUTDOWN, socket_.get(), uring_data(Uring_operation::shutdown));
+			entry.len = SHUT_WR;
+		}
+	}
+	
+	/// Prepares every operation which can proceed and is not already in flight
+	void uring_prepare_operations()
+	{
+		uring_prepare_send();
+		
+		if (not stdin_closed_ and not uring_reading_stdin_
+			and outbound_size() + uring_sending_.size() - uring_sending_offset_ < outbound_high_water_mark)
+		{
+			uring_read_stdin();
+		}
+		
+		for (std::size_t i = 0; i != output_queues_.size(); ++i)
+		{
+			if (output_queues_[i].size() != 0 and not uring_writing_[i])
+			{
+				uring_write_output(i);
+			}
+		}
+		
+		if (not inbound_paused_ and output_size() > output_high_water_mark)
+		{
+			inbound_paused_ = true;
+		}
+		else if (inbound_paused_ and output_size() < output_low_water_mark)
+		{
+			inbound_paused_ = false;
+		}
+		
+		if (not uring_receiving_ and not inbound_paused_ and not uring_inbound_closed_)
+		{
+			uring_receive();
+		}
+	}
+	
+	void uring_complete(const io_uring_cqe& completion)
+	{
+		auto operation = Uring_operation(completion.user_data >> 8);
+		auto index = std::size_t(completion.user_data & 0xff);
+		auto result = completion.res;
+		
+		if (operation == Uring_operation::connect)
+		{
+			uring_connecting_ = false;
+			
+			if (result < 0)
+			{
+				// the linked operations are cancelled, the connection itself is only interrupted by its timeout
+				outbound_closed_ = true;
+				auto error = result == -ECANCELED or result == -EINTR ? ETIMEDOUT : -result;
+				throw std::runtime_error(std::string("failed to connect to ") + transport_.name_ + ": " + std::strerror(error));
+			}
+			
+			DAIYOUSEI_PROBE(connected, socket_.get(), connect_backoff_.retries_);
+			
+			if (trace_)
+			{
+				trace_->mark(Trace::Phase::connected);
+			}
+		}
+		else if (operation == Uring_operation::send)
+		{
+			if (result < 0)
+			{
+				throw std::runtime_error(std::string("failed to send message: ") + std::strerror(-result));
+			}
+			
+			count_sent(result);
+			uring_sending_offset_ += result;
+			
+			if (uring_sending_offset_ != uring_sending_.size())
+			{
+				uring_send();
+			}
+			else
+			{
+				uring_sending_.clear();
+				uring_sending_offset_ = 0;
+			}
+		}
+		else if (operation == Uring_operation::receive)
+		{
+			uring_received(result);
+			
+			if (result > 0)
+			{
+				++statistics_.reads_;
+				count_received(result);
+				parse_received();
+			}
+			else if (result == 0)
+			{
+				uring_inbound_closed_ = true;
+			}
+			else if (result != -ECANCELED and result != -EINTR)
+			{
+				// the receive is cancelled if sending the preceding preamble was interrupted, then it is submitted again
+				throw std::runtime_error(std::string("read from file descriptor '" + std::to_string(socket_.get()) + "' failed: ") + std::strerror(-result));
+			}
+		}
+		else if (operation == Uring_operation::read_stdin)
+		{
+			uring_reading_stdin_ = false;
+			
+			if (result == -EAGAIN)
+			{
+				uring_read_stdin(true);
+			}
+			else if (result == -EINTR)
+			{
+				uring_read_stdin();
+			}
+			else if (result < 0)
+			{
+				throw std::runtime_error(std::string("read from file descriptor '0' failed: ") + std::strerror(-result));
+			}
+			else
+			{
+				++statistics_.reads_;
+				input_.append(uring_->fixed_buffer_.data(), result);
+				send_stdin();
+				
+				if (result == 0)
+				{
+					close_stdin();
+				}
+			}
+		}
+		else if (operation == Uring_operation::write_output)
+		{
+			uring_writing_[index] = false;
+			
+			if (result == -EAGAIN)
+			{
+				uring_write_output(index, true);
+			}
+			else if (result < 0)
+			{
+				throw std::runtime_error(std::string("writing to ") + (output_queues_[index].front_fd() == 1 ? "stdout" : "stderr") + " failed: " + std::strerror(-result));
+			}
+			else
+			{
+				++statistics_.output_writes_;
+				output_queues_[index].consume(result);
+			}
+		}
+		else if (operation == Uring_operation::shutdown and result < 0)
+		{
+			global::report({"socket shutdown failed: ", std::strerror(-result)});
+		}
+	}
+	
+	/// Runs the communication by submitting the operations to io_uring(7), the connection,
+	/// the preamble and the first receive are submitted as a chain of linked entries together
+	/// with the first read of the standard input using a single system call
+	/// @return Whether the server has not closed the connection
+	bool run_uring()
+	{
+		{
+			auto communication = std::experimental::unique_resource(this, +[](Client* self) -> void
+			{
+				self->close_outbound();
+			});
+			
+			auto& connect = uring_->prepare(IORING_OP_CONNECT, socket_.get(), uring_data(Uring_operation::connect));
+			connect.addr = reinterpret_cast<std::uint64_t>(&transport_.address_);
+			connect.off = transport_.address_length_;
+			connect.flags |= IOSQE_IO_LINK;
+			uring_connecting_ = true;
+			
+			// the kernel itself waits while the listen backlog of the server is full
+			uring_connect_timeout_.tv_sec = connect_timeout_.count() / 1000;
+			uring_connect_timeout_.tv_nsec = connect_timeout_.count() % 1000 * 1'000'000;
+			auto& timeout = uring_->prepare(IORING_OP_LINK_TIMEOUT, -1, uring_data(Uring_operation::connect_timeout));
+			timeout.addr = reinterpret_cast<std::uint64_t>(&uring_connect_timeout_);
+			timeout.len = 1;
+			timeout.flags |= IOSQE_IO_LINK;
+			
+			std::swap(uring_sending_, outbound_);
+			uring_sending_offset_ = std::exchange(outbound_offset_, 0);
+			uring_send(IOSQE_IO_LINK);
+			uring_receive();
+			
+			while (not uring_inbound_closed_ and not response_finished())
+			{
+				uring_prepare_operations();
+				uring_->submit_and_wait(1);
+				uring_->for_each_completion([this](const io_uring_cqe& completion) -> void
+				{
+					uring_complete(completion);
+				});
+			}
+			
+			// the remaining output is written, then all other operations are cancelled
+			while (output_size() != 0 or uring_writing_[0] or uring_writing_[1])
+			{
+				for (std::size_t i = 0; i != output_queues_.size(); ++i)
+				{
+					if (output_queues_[i].size() != 0 and not uring_writing_[i])
+					{
+						uring_write_output(i);
+					}
+				}
+				
+				uring_->submit_and_wait(1);
+				uring_->for_each_completion([this](const io_uring_cqe& completion) -> void
+				{
+					auto operation = Uring_operation(completion.user_data >> 8);
+					
+					if (operation == Uring_operation::write_output)
+					{
+						uring_complete(completion);
+					}
+					else if (operation == Uring_operation::receive)
+					{
+						// data following the end of the communication are ignored
+						uring_received(0);
+					}
+				});
+			}
+			
+			if (uring_->in_flight_ != 0)
+			{
+				auto& cancel = uring_->prepare(IORING_OP_ASYNC_CANCEL, -1, uring_data(Uring_operation::cancel));
+				cancel.cancel_flags = IORING_ASYNC_CANCEL_ANY;
+			}
+			
+			while (uring_->in_flight_ != 0)
+			{
+				uring_->submit_and_wait(1);
+				uring_->for_each_completion([this](const io_uring_cqe& completion) -> void
+				{
+					auto operation = Uring_operation(completion.user_data >> 8);
+					
+					// only the bytes which were sent count, the rest of the message is cut off
+					if (operation == Uring_operation::send and completion.res > 0)
+					{
+						uring_sending_offset_ += completion.res;
+					}
+					else if (operation == Uring_operation::receive)
+					{
+						uring_received(0);
+					}
+				});
+			}
+			
+			if (uring_sending_offset_ == uring_sending_.size())
+			{
+				uring_sending_.clear();
+				uring_sending_offset_ = 0;
+			}
+		}
+		
+		return not uring_inbound_closed_;
+	}
+#endif
+
+	/// @return Whether the server has not closed the connection
+	bool run_epoll()
+	{
+		auto events = std::array<epoll_event, 8>();
+		bool server_input_available = true;
+		
+		{
+			auto communication = std::experimental::unique_resource(this, +[](Client* self) -> void
+			{
+				self->close_outbound();
+			});
+			
+			while (server_input_available and not response_finished())
+			{
+				bool stdin_ready = not stdin_closed_ and not awaiting_acknowledgement() and (shared_memory_ == Negotiation::accepted
+					? stdin_type_ != Stdin_type::pollable and shared_rings_->stdin_.writable() != 0
+					: stdin_type_ == Stdin_type::not_pollable and outbound_size() < outbound_high_water_mark
+				);
+				
+				if (stdin_ready)
+				{
+					receive_stdin();
+				}
+				
+				if (shared_memory_ == Negotiation::accepted)
+				{
+					// the server wakes the client up if it changes the rings after this point
+					shared_rings_->client_waiting().store(1);
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+					receive_ring_output();
+					flush_outputs();
+					update_events();
+				}
+				
+				auto timeout = -1;
+				if (stdin_ready)
+				{
+					timeout = 0;
+				}
+				else if (awaiting_acknowledgement())
+				{
+					auto remaining = std::chrono::ceil<std::chrono::milliseconds>(acknowledgement_deadline_ - std::chrono::steady_clock::now());
+					timeout = int(std::max(remaining.count(), decltype(remaining)::rep(0)));
+				}
+				
+				auto ready_events = epoll_wait(epoll_fd_.get(), events.data(), events.size(), timeout);
+				
+				if (awaiting_acknowledgement() and std::chrono::steady_clock::now() >= acknowledgement_deadline_)
+				{
+					reject_pending();
+				}
+				
+				if (shared_memory_ == Negotiation::accepted)
+				{
+					shared_rings_->client_waiting().store(0, std::memory_order_relaxed);
+				}
+				
+				for (int i = 0; i != ready_events; ++i)
+				{
+					if (events[i].data.fd == 0)
+					{
+						if (not stdin_closed_)
+						{
+							receive_stdin();
+						}
+					}
+					else if (stdin_coalescing_ and events[i].data.fd == stdin_timer_.get())
+					{
+						auto expirations = std::uint64_t();
+						if (read(stdin_timer_.get(), &expirations, sizeof(expirations)) == sizeof(expirations))
+						{
+							stdin_timer_armed_ = false;
+							send_stdin();
+						}
+					}
+					else if (shared_rings_ and events[i].data.fd == shared_rings_->client_event_.get())
+					{
+						auto value = eventfd_t();
+						eventfd_read(shared_rings_->client_event_.get(), &value);
+					}
+					else if (events[i].data.fd == 1 or events[i].data.fd == 2)
+					{
+						flush_outputs(events[i].data.fd);
+						
+						if (events[i].data.fd == 1 and splicing())
+						{
+							server_input_available = splice_stdout();
+						}
+						
+						update_events();
+					}
+					else
+					{
+						if (events[i].events & EPOLLOUT)
+						{
+							flush_outbound();
+							
+							if (stdin_type_ == Stdin_type::regular_file)
+							{
+								send_stdin_file();
+								update_events();
+							}
+						}
+						
+						if (events[i].events & ~EPOLLOUT and not inbound_paused_)
+						{
+							if (splicing())
+							{
+								server_input_available = splice_stdout();
+							}
+							else
+							{
+								if (read_socket() == 0)
+								{
+									server_input_available = false;
+								}
+								
+								parse_received();
+								try_start_splice();
+							}
+							
+							flush_outputs();
+							
+							if (splicing())
+							{
+								server_input_available = splice_stdout() and server_input_available;
+							}
+							
+							update_events();
+						}
+					}
+				}
+			}
+			
+			// whatever has already arrived after the exit code is still checked, without waiting for more
+			if (auto descriptor = pollfd {.fd = socket_.get(), .events = POLLIN, .revents = 0};
+				communication_status_ != Communication_status::terminated and server_input_available and poll(&descriptor, 1, 0) == 1)
+			{
+				server_input_available = read_socket() != 0;
+				parse_received();
+			}
+		}
+		
+		// the server writes all output to the ring before sending the exit code
+		while (shared_memory_ == Negotiation::accepted and response_finished())
+		{
+			receive_ring_output();
+			drain_outputs();
+			
+			if (shared_rings_->output_.readable() == 0)
+			{
+				if (shared_rings_->record_remaining_ != 0)
+				{
+					throw std::runtime_error("communication terminated with an incomplete record in the shared memory output ring");
+				}
+				
+				break;
+			}
 		}
+		
+		drain_outputs();
+		return server_input_available;
+	}
+	
+	/// Writes the trace line and adds the invocation to the shared histograms, also if the communication failed
+	void write_trace() noexcept
+	{
+		trace_->mark(Trace::Phase::finished);
+		
+		if (trace_->stats_path_)
+		{
+			// the file name, so that the symbolic links to the client are told apart
+			auto name = program_.substr(program_.rfind('/') + 1);
+			auto values = std::array<std::optional<std::uint64_t>, stats::metric_names.size()>();
+			values[std::size_t(stats::Metric::connect)] = trace_->elapsed(Trace::Phase::connected);
+			values[std::size_t(stats::Metric::first_byte)] = trace_->elapsed(Trace::Phase::first_byte);
+			values[std::size_t(stats::Metric::total)] = trace_->elapsed(Trace::Phase::finished);
+			values[std::size_t(stats::Metric::bytes_sent)] = statistics_.sent_bytes_;
+			values[std::size_t(stats::Metric::bytes_received)] = statistics_.received_bytes_;
+			stats::record(trace_->stats_path_, name, not exitcode_, values);
+		}
+		
+		if (trace_->destination_.empty())
+		{
+			return;
+		}
+		
+		try
+		{
+			auto line = trace_->begin_line();
+			line.string_field("program", program_);
+			line.string_field("backend", uses_uring() ? "io_uring" : "epoll");
+			line.raw_field("exitcode", exitcode_ ? std::to_string(*exitcode_) : "null");
+			line.field("bytes_sent", statistics_.sent_bytes_);
+			line.field("bytes_received", statistics_.received_bytes_);
+			line.field("sends", statistics_.sends_);
+			line.field("reads", statistics_.reads_);
+			line.field("output_writes", statistics_.output_writes_);
+			line.field("receive_calls", trace_->receive_calls_);
+			line.field("peak_buffer", trace_->peak_buffer_size_);
+			line.field("connect_retries", connect_backoff_.retries_);
+			trace_->write(std::move(line));
+		}
+		catch (std::exception&)
+		{
+		}
+	}
+	
+	int run()
+	{
+		auto finish = std::experimental::unique_resource(this, +[](Client* self) -> void
+		{
+			DAIYOUSEI_PROBE(exit, self->exitcode_ ? int(*self->exitcode_) : -1, self->communication_status_ == Communication_status::terminated);
+			
+			if (self->trace_)
+			{
+				self->write_trace();
+			}
+		});
+
+#ifdef DAIYOUSEI_IO_URING
+		bool server_input_available = uses_uring() ? run_uring() : run_epoll();
+#else
+		bool server_input_available = run_epoll();
+#endif
+
+		if (statistics_enabled_)
+		{
+			global::report({"statistics:",
+				" output chunks: ", std::to_string(statistics_.output_chunks_),
+				", output writes: ", std::to_string(statistics_.output_writes_),
+				", writes saved: ", std::to_string(statistics_.output_chunks_ - std::min(statistics_.output_chunks_, statistics_.output_writes_)),
+				", reads: ", std::to_string(statistics_.reads_),
+				", spliced bytes: ", std::to_string(statistics_.spliced_bytes_),
+				", connect retries: ", std::to_string(connect_backoff_.retries_),
+				", backend: ", uses_uring() ? "io_uring" : "epoll",
+			});
+		}
+		
+		if (not server_input_available and communication_status_ != Communication_status::terminated)
+		{
+			throw std::runtime_error(std::string("communication terminated by the server without sending end of list"));
+		}
+		
+		if (not data_.empty())
+		{
+			throw std::runtime_error(std::string("communication terminated with trailing data: ") + data_);
+		}
+		
+		if (batch_connection_)
+		{
+			data_.clear();
+			batch_connection_->data_ = std::move(data_);
+			batch_connection_->capabilities_ = Capabilities();
+			
+			if (capabilities_.batch_ and server_input_available)
+			{
+				batch_connection_->socket_ = std::move(socket_);
+				batch_connection_->capabilities_ = capabilities_;
+			}
+		}
+		
+		if (recording_)
+		{
+			recording_->cacheable_ = cacheable_;
+		}
+		
+		if (exitcode_)
+		{
+			return int(*exitcode_);
+		}
+		else
+		{
+			throw std::runtime_error("communication terminated without setting the exit code");
+		}
+	}
+	
+	/// Whether the client stops receiving, in the fast exit mode already once the exit code
+	/// is received and nothing remains to be spliced
+	bool response_finished() const noexcept
+	{
+		return communication_status_ == Communication_status::terminated or (fast_exit_ and exitcode_ and not splicing());
+	}
+	
+	void on_stdout(std::string_view data) override
+	{
+		outputs_[0]->push(1, data);
+		++statistics_.output_chunks_;
+	}
+	
+	void on_stderr(std::string_view data) override
+	{
+		outputs_[1]->push(2, data);
+		++statistics_.output_chunks_;
 	}
 };
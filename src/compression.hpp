@@ -0,0 +1,106 @@
+#pragma once
+
+#include <zlib.h>
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+
+/// A single raw deflate stream per direction, each chunk is compressed with a sync flush
+/// so that the receiver can decompress it as soon as it arrives while the following chunks
+/// still benefit from the history of the previous ones
+namespace compression
+{
+struct Deflater
+{
+	z_stream stream_ {};
+	
+	Deflater(int level = Z_BEST_SPEED)
+	{
+		if (auto result = deflateInit2(&stream_, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY); result != Z_OK)
+		{
+			throw std::runtime_error(std::string("failed to initialize compression: ") + zError(result));
+		}
+	}
+	
+	Deflater(const Deflater&) = delete;
+	Deflater& operator=(const Deflater&) = delete;
+	
+	~Deflater()
+	{
+		deflateEnd(&stream_);
+	}
+	
+	/// Appends the compressed @p input to @p output
+	void compress(std::string_view input, std::string& output)
+	{
+		stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+		stream_.avail_in = input.size();
+		
+		do
+		{
+			auto offset = output.size();
+			auto size = deflateBound(&stream_, stream_.avail_in) + 16;
+			output.resize(offset + size);
+			stream_.next_out = reinterpret_cast<Bytef*>(output.data() + offset);
+			stream_.avail_out = size;
+			
+			if (auto result = deflate(&stream_, Z_SYNC_FLUSH); result != Z_OK and result != Z_BUF_ERROR)
+			{
+				throw std::runtime_error(std::string("compression failed: ") + zError(result));
+			}
+			
+			output.resize(output.size() - stream_.avail_out);
+		}
+		while (stream_.avail_out == 0);
+	}
+};
+
+struct Inflater
+{
+	z_stream stream_ {};
+	
+	Inflater()
+	{
+		if (auto result = inflateInit2(&stream_, -MAX_WBITS); result != Z_OK)
+		{
+			throw std::runtime_error(std::string("failed to initialize decompression: ") + zError(result));
+		}
+	}
+	
+	Inflater(const Inflater&) = delete;
+	Inflater& operator=(const Inflater&) = delete;
+	
+	~Inflater()
+	{
+		inflateEnd(&stream_);
+	}
+	
+	/// Decompresses @p input, which may be any part of the compressed stream,
+	/// and passes the decompressed data to @p sink in pieces
+	void decompress(std::string_view input, auto&& sink)
+	{
+		auto buffer = std::array<char, 64 * 1024>();
+		stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+		stream_.avail_in = input.size();
+		
+		do
+		{
+			stream_.next_out = reinterpret_cast<Bytef*>(buffer.data());
+			stream_.avail_out = buffer.size();
+			
+			if (auto result = inflate(&stream_, Z_SYNC_FLUSH); result != Z_OK and result != Z_BUF_ERROR)
+			{
+				throw std::runtime_error(std::string("decompression failed: ") + (stream_.msg ? stream_.msg : zError(result)));
+			}
+			
+			if (auto size = buffer.size() - stream_.avail_out; size != 0)
+			{
+				sink(std::string_view(buffer.data(), size));
+			}
+		}
+		while (stream_.avail_out == 0);
+	}
+};
+}
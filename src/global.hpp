@@ -0,0 +1,67 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <cstddef>
+
+#include <array>
+#include <initializer_list>
+#include <string_view>
+
+/// The names of the program and of its environment variables, the limits of the protocol
+/// and the reporting of errors, shared by the client, the library and the tools
+namespace global
+{
+constexpr std::string_view program_name = "daiyousei";
+constexpr std::string_view default_unix_socket_name = "daiyousei.sock";
+constexpr std::string_view env_name_unix_socket = "DAIYOUSEI_UNIX_SOCKET";
+constexpr std::string_view env_name_socket = "DAIYOUSEI_SOCKET";
+constexpr std::string_view env_name_socket_buffer_size = "DAIYOUSEI_SOCKET_BUFFER_SIZE";
+/// The longest byte string that the client accepts, also used as the size of standard input chunks sent from files
+constexpr std::size_t max_byte_string_length = 999'999;
+constexpr std::string_view env_name_statistics = "DAIYOUSEI_STATISTICS";
+constexpr std::string_view env_name_stdin_coalesce = "DAIYOUSEI_STDIN_COALESCE";
+constexpr std::string_view env_name_max_read_size = "DAIYOUSEI_MAX_READ_SIZE";
+constexpr std::string_view env_name_splice_threshold = "DAIYOUSEI_SPLICE_THRESHOLD";
+constexpr std::string_view env_name_pass_fds = "DAIYOUSEI_PASS_FDS";
+constexpr std::string_view env_name_shared_memory = "DAIYOUSEI_SHARED_MEMORY";
+constexpr std::string_view env_name_capabilities = "DAIYOUSEI_CAPABILITIES";
+constexpr std::string_view env_name_compression_threshold = "DAIYOUSEI_COMPRESSION_THRESHOLD";
+constexpr std::string_view env_name_io_uring = "DAIYOUSEI_IO_URING";
+constexpr std::string_view env_name_connect_timeout = "DAIYOUSEI_CONNECT_TIMEOUT";
+constexpr std::string_view env_name_server_command = "DAIYOUSEI_SERVER_COMMAND";
+constexpr std::string_view env_name_batch = "DAIYOUSEI_BATCH";
+constexpr std::string_view env_name_cache = "DAIYOUSEI_CACHE";
+constexpr std::string_view env_name_cache_commands = "DAIYOUSEI_CACHE_COMMANDS";
+constexpr std::string_view env_name_cache_env = "DAIYOUSEI_CACHE_ENV";
+constexpr std::string_view env_name_digests = "DAIYOUSEI_DIGESTS";
+constexpr std::string_view env_name_argv_prefix = "DAIYOUSEI_ARGV_PREFIX";
+constexpr std::string_view env_name_fast_exit = "DAIYOUSEI_FAST_EXIT";
+constexpr std::string_view env_name_trace = "DAIYOUSEI_TRACE";
+constexpr std::string_view env_name_stats_file = "DAIYOUSEI_STATS_FILE";
+
+/// Writes the program name and the concatenation of @p parts as a line to the standard error output
+/// by a single writev(2), so that the client does not need iostreams, which are initialized
+/// at the start of every process that includes them, parts beyond the first 29 are left out
+[[gnu::cold]] inline void report(std::initializer_list<std::string_view> parts) noexcept
+{
+	auto iov = std::array<iovec, 32>();
+	auto count = std::size_t(0);
+	
+	for (auto part : {program_name, std::string_view(": ")})
+	{
+		iov[count++] = iovec {.iov_base = const_cast<char*>(part.data()), .iov_len = part.size()};
+	}
+	
+	for (auto part : parts)
+	{
+		if (count != iov.size() - 1)
+		{
+			iov[count++] = iovec {.iov_base = const_cast<char*>(part.data()), .iov_len = part.size()};
+		}
+	}
+	
+	iov[count++] = iovec {.iov_base = const_cast<char*>("\n"), .iov_len = 1};
+	[[maybe_unused]] auto written = writev(2, iov.data(), int(count));
+}
+} // namespace global
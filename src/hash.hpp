@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <string_view>
+
+/// 128-bit FNV-1a, fast and well spread but not resistant to deliberately crafted collisions
+struct Hash
+{
+	std::uint64_t high_ = 0x6c62272e07bb0142;
+	std::uint64_t low_ = 0x62b821756295c58d;
+	
+	void update(std::string_view data) noexcept
+	{
+		for (auto c : data)
+		{
+			low_ ^= std::uint8_t(c);
+			
+			// the prime is 2^88 + 0x13b
+			auto carry = ((low_ >> 32) * 0x13b + (((low_ & 0xffffffff) * 0x13b) >> 32)) >> 32;
+			high_ = high_ * 0x13b + carry + (low_ << 24);
+			low_ *= 0x13b;
+		}
+	}
+	
+	std::string hex() const
+	{
+		constexpr auto digits = std::string_view("0123456789abcdef");
+		auto result = std::string(32, '0');
+		
+		for (std::size_t i = 0; i != 16; ++i)
+		{
+			auto byte = std::uint8_t(i < 8 ? high_ >> (8 * (7 - i)) : low_ >> (8 * (15 - i)));
+			result[2 * i] = digits[byte >> 4];
+			result[2 * i + 1] = digits[byte & 0xf];
+		}
+		
+		return result;
+	}
+};
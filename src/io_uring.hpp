@@ -0,0 +1,234 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <experimental/scope>
+#include <experimental/array>
+
+/// A minimal io_uring(7) instance driven by the raw system calls, with one registered buffer
+namespace uring
+{
+/// Operations the client submits, the kernel must support all of them
+constexpr auto required_operations = std::experimental::make_array<std::uint8_t>(
+	IORING_OP_CONNECT, IORING_OP_LINK_TIMEOUT, IORING_OP_SEND, IORING_OP_RECV, IORING_OP_READ_FIXED, IORING_OP_WRITEV,
+	IORING_OP_POLL_ADD, IORING_OP_SHUTDOWN, IORING_OP_ASYNC_CANCEL
+);
+
+struct Ring
+{
+	using Mapping = std::experimental::unique_resource<std::span<char>, void(*)(std::span<char>)>;
+	
+	/// The registered buffer is unmapped only after the ring is closed and its operations are cancelled
+	Mapping buffer_;
+	std::experimental::unique_resource<int, void(*)(int)> fd_;
+	Mapping rings_;
+	Mapping entries_;
+	
+	io_uring_sqe* sqes_ = nullptr;
+	std::uint32_t* sq_head_ = nullptr;
+	std::uint32_t* sq_tail_ = nullptr;
+	std::uint32_t sq_mask_ = 0;
+	std::uint32_t sq_entries_ = 0;
+	
+	io_uring_cqe* cqes_ = nullptr;
+	std::uint32_t* cq_head_ = nullptr;
+	std::uint32_t* cq_tail_ = nullptr;
+	std::uint32_t cq_mask_ = 0;
+	
+	std::span<char> fixed_buffer_;
+	
+	/// Entries written to the submission queue but not yet submitted
+	std::uint32_t pending_ = 0;
+	/// Submitted operations which have not posted their last completion
+	std::size_t in_flight_ = 0;
+	
+	static void close_fd(int fd)
+	{
+		close(fd);
+	}
+	
+	static void unmap(std::span<char> mapping)
+	{
+		munmap(mapping.data(), mapping.size());
+	}
+	
+	static Mapping map(std::size_t size, int fd, off_t offset)
+	{
+		auto flags = fd == -1 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED | MAP_POPULATE;
+		auto mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, fd, offset);
+		if (mapping == MAP_FAILED)
+		{
+			return Mapping(std::span<char>(), &unmap);
+		}
+		
+		return Mapping(std::span(static_cast<char*>(mapping), size), &unmap);
+	}
+	
+	static int enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) noexcept
+	{
+		return int(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+	}
+	
+	static int register_resource(int fd, unsigned opcode, void* argument, unsigned count) noexcept
+	{
+		return int(syscall(__NR_io_uring_register, fd, opcode, argument, count));
+	}
+	
+	/// @return The ring, or nothing if the kernel does not support the required features,
+	/// in which case the caller falls back to epoll
+	/// @param entries The number of submission queue entries
+	/// @param buffer_size The size of the registered buffer
+	static std::optional<Ring> create(unsigned entries, std::size_t buffer_size)
+	{
+		auto result = Ring();
+		
+		// the completions are processed only when the client waits for them, which saves interrupting it
+		auto params = io_uring_params();
+		params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+		auto fd = int(syscall(__NR_io_uring_setup, entries, &params));
+		
+		if (fd == -1 and errno == EINVAL)
+		{
+			params = io_uring_params();
+			fd = int(syscall(__NR_io_uring_setup, entries, &params));
+		}
+		
+		result.fd_ = std::experimental::make_unique_resource_checked(fd, -1, &close_fd);
+		
+		constexpr auto required_features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_RW_CUR_POS | IORING_FEAT_FAST_POLL;
+		if (fd == -1 or (params.features & required_features) != required_features)
+		{
+			return std::nullopt;
+		}
+		
+		{
+			auto probe_storage = std::vector<std::uint64_t>((sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op)) / sizeof(std::uint64_t));
+			auto probe = reinterpret_cast<io_uring_probe*>(probe_storage.data());
+			
+			if (register_resource(fd, IORING_REGISTER_PROBE, probe, 256) == -1
+				or std::ranges::any_of(required_operations, [probe](std::uint8_t operation) -> bool
+				{
+					return operation > probe->last_op or not (probe->ops[operation].flags & IO_URING_OP_SUPPORTED);
+				}))
+			{
+				return std::nullopt;
+			}
+		}
+		
+		result.rings_ = map(std::max(params.sq_off.array + params.sq_entries * sizeof(std::uint32_t),
+			params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe)), fd, IORING_OFF_SQ_RING);
+		result.entries_ = map(params.sq_entries * sizeof(io_uring_sqe), fd, IORING_OFF_SQES);
+		
+		if (result.rings_.get().empty() or result.entries_.get().empty())
+		{
+			return std::nullopt;
+		}
+		
+		auto rings = result.rings_.get().data();
+		result.sqes_ = reinterpret_cast<io_uring_sqe*>(result.entries_.get().data());
+		result.sq_head_ = reinterpret_cast<std::uint32_t*>(rings + params.sq_off.head);
+		result.sq_tail_ = reinterpret_cast<std::uint32_t*>(rings + params.sq_off.tail);
+		result.sq_mask_ = *reinterpret_cast<std::uint32_t*>(rings + params.sq_off.ring_mask);
+		result.sq_entries_ = params.sq_entries;
+		result.cqes_ = reinterpret_cast<io_uring_cqe*>(rings + params.cq_off.cqes);
+		result.cq_head_ = reinterpret_cast<std::uint32_t*>(rings + params.cq_off.head);
+		result.cq_tail_ = reinterpret_cast<std::uint32_t*>(rings + params.cq_off.tail);
+		result.cq_mask_ = *reinterpret_cast<std::uint32_t*>(rings + params.cq_off.ring_mask);
+		
+		// each entry is submitted from its own slot
+		auto array = reinterpret_cast<std::uint32_t*>(rings + params.sq_off.array);
+		for (std::uint32_t i = 0; i != params.sq_entries; ++i)
+		{
+			array[i] = i;
+		}
+		
+		result.buffer_ = map(buffer_size, -1, 0);
+		
+		if (result.buffer_.get().empty())
+		{
+			return std::nullopt;
+		}
+		
+		result.fixed_buffer_ = result.buffer_.get();
+		
+		auto fixed_buffer = iovec {.iov_base = result.fixed_buffer_.data(), .iov_len = result.fixed_buffer_.size()};
+		if (register_resource(fd, IORING_REGISTER_BUFFERS, &fixed_buffer, 1) == -1)
+		{
+			return std::nullopt;
+		}
+		
+		return result;
+	}
+	
+	/// @return A cleared submission queue entry which is submitted by the next call to submit_and_wait
+	io_uring_sqe& prepare(std::uint8_t opcode, int fd, std::uint64_t user_data)
+	{
+		if (pending_ == sq_entries_)
+		{
+			submit_and_wait(0);
+		}
+		
+		auto tail = *sq_tail_;
+		auto& entry = sqes_[tail & sq_mask_];
+		entry = io_uring_sqe();
+		entry.opcode = opcode;
+		entry.fd = fd;
+		entry.user_data = user_data;
+		
+		std::atomic_ref(*sq_tail_).store(tail + 1, std::memory_order_release);
+		++pending_;
+		++in_flight_;
+		
+		return entry;
+	}
+	
+	/// Submits the prepared entries and waits until at least @p count completions are available
+	void submit_and_wait(unsigned count)
+	{
+		auto result = enter(fd_.get(), pending_, count, IORING_ENTER_GETEVENTS);
+		
+		if (result >= 0)
+		{
+			pending_ -= result;
+		}
+		else if (errno != EINTR)
+		{
+			throw std::runtime_error(std::string("failed to submit io_uring operations: ") + std::strerror(errno));
+		}
+	}
+	
+	/// Passes all available completions to @p function and releases them
+	void for_each_completion(auto&& function)
+	{
+		auto head = *cq_head_;
+		
+		while (head != std::atomic_ref(*cq_tail_).load(std::memory_order_acquire))
+		{
+			auto completion = cqes_[head & cq_mask_];
+			std::atomic_ref(*cq_head_).store(++head, std::memory_order_release);
+			
+			if (not (completion.flags & IORING_CQE_F_MORE))
+			{
+				--in_flight_;
+			}
+			
+			function(completion);
+		}
+	}
+};
+} // namespace uring
@@ -1,25 +1,40 @@
+#include <batch.hpp>
+#include <cache.hpp>
 #include <client.hpp>
 
-#include <iostream>
-
 int main(int argc, const char* const* argv)
 {
 	if (argc == 0)
 	{
-		std::clog << global::program_name << ": " << "argc is 0" << "\n";
+		global::report({"argc is 0"});
 	}
 	else try
 	{
-		auto client = Client(argc, argv);
+		if (std::getenv(global::env_name_batch.data()))
+		{
+			return Batch().run();
+		}
+		
+		auto arguments = std::vector<std::string_view>(argv, argv + argc);
+		auto environment = Client::process_environment();
+		auto cwd = Client::current_directory();
+		auto request = daiyousei::Request {.argv_ = arguments, .environment_ = environment, .cwd_ = cwd};
+		
+		if (auto cache = Cache::from_env(argv))
+		{
+			return cache->run(request);
+		}
+		
+		auto client = Client(request);
 		return client.run();
 	}
 	catch (bencode::Deserialization_exception& ex)
 	{
-		std::clog << global::program_name << ": deserialization error: " << ex.what() << "\n";
+		global::report({"deserialization error: ", ex.what()});
 	}
 	catch (std::exception& ex)
 	{
-		std::clog << global::program_name << ": " << ex.what() << "\n";
+		global::report({ex.what()});
 	}
 	
 	return 255;
@@ -0,0 +1,12 @@
+#pragma once
+
+/// Static tracepoints of the provider "daiyousei" for bpftrace(8), perf(1) or SystemTap.
+/// A probe is a single nop instruction and a note in the binary until a tracer attaches to it,
+/// its arguments are only integers and pointers which are at hand anyway.
+/// Without <sys/sdt.h>, or with DAIYOUSEI_NO_PROBES defined, the probes and their arguments vanish
+#if __has_include(<sys/sdt.h>) and not defined(DAIYOUSEI_NO_PROBES)
+#include <sys/sdt.h>
+#define DAIYOUSEI_PROBE(name, ...) STAP_PROBEV(daiyousei, name __VA_OPT__(,) __VA_ARGS__)
+#else
+#define DAIYOUSEI_PROBE(name, ...) static_cast<void>(0)
+#endif
@@ -0,0 +1,883 @@
+#include <session.hpp>
+
+#include <hash.hpp>
+#include <probes.hpp>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <ranges>
+#include <stdexcept>
+
+namespace daiyousei
+{
+namespace
+{
+void close_fd(int fd)
+{
+	close(fd);
+}
+
+std::experimental::unique_resource<int, void(*)(int)> no_fd()
+{
+	return std::experimental::make_unique_resource_checked(-1, -1, &close_fd);
+}
+} // namespace
+
+std::chrono::steady_clock::time_point Connect_backoff::retry(int error, const Transport& transport)
+{
+	auto now = std::chrono::steady_clock::now();
+	
+	if (error != EAGAIN or now >= deadline_)
+	{
+		auto message = std::string(std::strerror(error));
+		
+		if (retries_ != 0)
+		{
+			message += ", gave up after " + std::to_string(retries_) + " retries";
+		}
+		
+		throw std::runtime_error(std::string("failed to connect to ") + transport.name_ + ": " + message);
+	}
+	
+	if (not random_)
+	{
+		random_.emplace(std::random_device()());
+	}
+	
+	// the clients which were refused together spread over the upper half of the backoff interval
+	auto delay = std::uniform_int_distribution<std::chrono::microseconds::rep>(backoff_.count() / 2, backoff_.count())(*random_);
+	backoff_ = std::min(2 * backoff_, std::chrono::microseconds(100'000));
+	++retries_;
+	return std::min<std::chrono::steady_clock::time_point>(now + std::chrono::microseconds(delay), deadline_);
+}
+
+bool* Session::Capabilities::find(std::string_view name) noexcept
+{
+	if (name == "frames")
+	{
+		return &frames_;
+	}
+	else if (name == "batch")
+	{
+		return &batch_;
+	}
+	else if (name == "cache")
+	{
+		return &cache_;
+	}
+#ifdef DAIYOUSEI_ZLIB
+	else if (name == "deflate")
+	{
+		return &deflate_;
+	}
+#endif
+
+	return nullptr;
+}
+
+Session::Capabilities Session::Capabilities::all() noexcept
+{
+	auto result = Capabilities();
+	for (auto name : names)
+	{
+		*result.find(name) = true;
+	}
+	return result;
+}
+
+Session::Capabilities Session::Capabilities::parse(std::string_view value)
+{
+	auto result = Capabilities();
+	
+	while (not value.empty())
+	{
+		auto name = value.substr(0, value.find(','));
+		value.remove_prefix(std::min(value.size(), name.size() + 1));
+		
+		if (auto capability = result.find(name))
+		{
+			*capability = true;
+		}
+		else
+		{
+			throw std::runtime_error(std::string("invalid value of ") + std::string(global::env_name_capabilities) + ", unknown capability: " + std::string(name));
+		}
+	}
+	
+	return result;
+}
+
+Session::Session()
+{
+	connection_.socket_ = no_fd();
+}
+
+Session::Session(const Request& request)
+	:
+	Session()
+{
+	serialize_request(request);
+	std::swap(connection_.outbound_, serializer_.buffer_);
+}
+
+Session::~Session()
+{
+	if (connection_.loop_ and connection_.status_ != Connection::Status::done)
+	{
+		connection_.loop_->release(*this);
+	}
+}
+
+void Session::write_stdin(std::string_view data)
+{
+	if (stdin_closed_)
+	{
+		throw std::logic_error(std::string("writing the standard input after it was closed"));
+	}
+	
+	send_stdin_chunks(data, std::numeric_limits<std::size_t>::max());
+}
+
+void Session::close_stdin()
+{
+	if (std::exchange(stdin_closed_, true))
+	{
+		return;
+	}
+	
+	send({"e"});
+}
+
+void Session::send(std::initializer_list<std::string_view> parts)
+{
+	for (auto part : parts)
+	{
+		connection_.outbound_ += part;
+	}
+	
+	if (connection_.status_ == Connection::Status::connected)
+	{
+		connection_.loop_->update(*this);
+	}
+}
+
+void Session::reject_pending()
+{
+	if (digests_ == Negotiation::pending)
+	{
+		digests_ = Negotiation::rejected;
+	}
+}
+
+void Session::serialize_digests(const Request& request, std::size_t argv_prefix)
+{
+	serializer_.push_raw_data("l");
+	serializer_.push_raw_data("7:digests");
+	serializer_.push_raw_data("d");
+	
+	if (argv_prefix != 0)
+	{
+		auto prefix = bencode::Serializer::create();
+		prefix.push_raw_data("l");
+		for (auto argument : request.argv_.first(argv_prefix))
+		{
+			prefix.push_byte_string(argument);
+		}
+		prefix.push_raw_data("e");
+		
+		auto hash = Hash();
+		hash.update(prefix.buffer_);
+		serializer_.push_raw_data("4:argv");
+		serializer_.push_byte_string(hash.hex());
+		offered_digests_.argv_ = true;
+	}
+	
+	// sorted by the serialized name=value form, in which the process received them
+	auto variables = std::vector(request.environment_.begin(), request.environment_.end());
+	std::ranges::sort(variables, [](const auto& left, const auto& right) -> bool
+	{
+		auto joined = [](const auto& variable) -> std::array<std::string_view, 3>
+		{
+			return {variable.first, "=", variable.second};
+		};
+		
+		return std::ranges::lexicographical_compare(joined(left) | std::views::join, joined(right) | std::views::join, [](char left, char right) -> bool
+		{
+			return std::uint8_t(left) < std::uint8_t(right);
+		});
+	});
+	
+	auto environment = bencode::Serializer::create();
+	environment.push_raw_data("l");
+	for (const auto& [name, value] : variables)
+	{
+		environment.push_byte_string(name);
+		environment.push_byte_string(value);
+	}
+	environment.push_raw_data("e");
+	
+	auto hash = Hash();
+	hash.update(environment.buffer_);
+	serializer_.push_raw_data("3:env");
+	serializer_.push_byte_string(hash.hex());
+	offered_digests_.env_ = true;
+	
+	serializer_.push_raw_data("e");
+	digests_ = Negotiation::pending;
+}
+
+void Session::serialize_request(const Request& request, std::size_t argv_prefix)
+{
+	// the offered digests have already started the request
+	if (digests_ == Negotiation::disabled)
+	{
+		serializer_.push_raw_data("l");
+	}
+	
+	serializer_.push_raw_data("4:argv");
+	serializer_.push_raw_data("l");
+	for (auto argument : request.argv_.subspan(known_digests_.argv_ ? argv_prefix : 0))
+	{
+		serializer_.push_byte_string(argument);
+	}
+	serializer_.push_raw_data("e");
+	serializer_.push_raw_data("3:cwd");
+	serializer_.push_byte_string(request.cwd_);
+	
+	if (not known_digests_.env_)
+	{
+		serializer_.push_raw_data("3:env");
+		serializer_.push_raw_data("l");
+		for (const auto& [name, value] : request.environment_)
+		{
+			serializer_.push_byte_string(name);
+			serializer_.push_byte_string(value);
+		}
+		serializer_.push_raw_data("e");
+	}
+	
+	if (std::ranges::any_of(Capabilities::names, [this](std::string_view name) -> bool {return *offered_capabilities_.find(name);}))
+	{
+		serializer_.push_raw_data("12:capabilities");
+		serializer_.push_raw_data("l");
+		for (auto name : Capabilities::names)
+		{
+			if (*offered_capabilities_.find(name))
+			{
+				serializer_.push_byte_string(name);
+			}
+		}
+		serializer_.push_raw_data("e");
+	}
+}
+
+std::string_view Session::stdin_header(std::array<char, max_stdin_header_length>& buffer, std::size_t length, bool compressed) const noexcept
+{
+	if (capabilities_.frames_)
+	{
+		buffer[0] = compressed ? frame_compressed : 0;
+		for (std::size_t i = 0; i != 4; ++i)
+		{
+			buffer[1 + i] = char(length >> (8 * i));
+		}
+		
+		return std::string_view(buffer.data(), frame_header_size);
+	}
+	
+	auto end = std::ranges::copy(std::string_view("5:stdin"), buffer.data()).out;
+	end = std::to_chars(end, buffer.data() + buffer.size(), length).ptr;
+	*end++ = ':';
+	return std::string_view(buffer.data(), end);
+}
+
+void Session::send_stdin_chunks(std::string_view data, std::size_t max_message_size)
+{
+	// the payload is sent directly from the data, only the header is formatted separately
+	auto header = std::array<char, max_stdin_header_length>();
+	
+	// a socket which preserves message boundaries limits the size of each chunk, as does the encoding,
+	// incompressible data grows by at most 5 bytes per 16 KiB block and a few bytes of the flush
+	auto chunk_limit = std::min(max_message_size - max_stdin_header_length,
+		capabilities_.frames_ ? max_frame_length : global::max_byte_string_length);
+	chunk_limit -= std::min(chunk_limit / 2048 + 64, chunk_limit / 2);
+	
+	while (not data.empty())
+	{
+		auto chunk = data.substr(0, chunk_limit);
+		data.remove_prefix(chunk.size());
+
+#ifdef DAIYOUSEI_ZLIB
+		if (deflater_ and chunk.size() >= compression_threshold_)
+		{
+			compressed_.clear();
+			deflater_->compress(chunk, compressed_);
+			DAIYOUSEI_PROBE(stdin_chunk, chunk.size(), compressed_.size());
+			send({stdin_header(header, compressed_.size(), true), compressed_});
+			continue;
+		}
+#endif
+
+		DAIYOUSEI_PROBE(stdin_chunk, chunk.size(), 0);
+		send({stdin_header(header, chunk.size()), chunk});
+	}
+}
+
+std::uint32_t Session::wanted_events() const noexcept
+{
+	switch (connection_.status_)
+	{
+	case Connection::Status::connecting:
+		return connection_.socket_.get() != -1 and connection_.retry_time_ == std::chrono::steady_clock::time_point() ? std::uint32_t(EPOLLOUT) : 0;
+	case Connection::Status::connected:
+		return EPOLLIN | (connection_.outbound_.empty() ? 0 : std::uint32_t(EPOLLOUT));
+	default:
+		return 0;
+	}
+}
+
+void Session::flush_outbound()
+{
+	auto& outbound = connection_.outbound_;
+	
+	while (not outbound.empty())
+	{
+		auto sent = ::send(connection_.socket_.get(), outbound.data(), outbound.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+		
+		if (sent != -1)
+		{
+			outbound.erase(0, sent);
+		}
+		else if (errno == EWOULDBLOCK or errno == EAGAIN)
+		{
+			return;
+		}
+		else if (errno == EPIPE or errno == ECONNRESET)
+		{
+			// the server has stopped reading, the rest of the response decides the result
+			outbound.clear();
+			stdin_closed_ = true;
+			connection_.shut_down_ = true;
+			return;
+		}
+		else if (errno != EINTR)
+		{
+			throw std::runtime_error(std::string("failed to send to the server: ") + std::strerror(errno));
+		}
+	}
+	
+	if (stdin_closed_ and not std::exchange(connection_.shut_down_, true))
+	{
+		shutdown(connection_.socket_.get(), SHUT_WR);
+	}
+}
+
+void Session::output(int fd, std::string_view data)
+{
+	if (fd == 1)
+	{
+		on_stdout(data);
+	}
+	else
+	{
+		on_stderr(data);
+	}
+}
+
+void Session::visit_list_begin()
+{
+	if (communication_status_ == Communication_status::ongoing and last_key_ == "capabilities" and not receiving_capabilities_)
+	{
+		receiving_capabilities_ = true;
+	}
+	else if (communication_status_ == Communication_status::ongoing and last_key_ == "digests" and not receiving_digests_)
+	{
+		receiving_digests_ = true;
+	}
+	else if (communication_status_ != Communication_status::not_started)
+	{
+		throw std::runtime_error(std::string("unexpected start of list"));
+	}
+	else
+	{
+		communication_status_ = Communication_status::ongoing;
+	}
+}
+
+void Session::visit_list_end()
+{
+	if (receiving_capabilities_)
+	{
+		receiving_capabilities_ = false;
+		last_key_.clear();
+		
+		if (capabilities_.deflate_ and not capabilities_.frames_)
+		{
+			throw std::runtime_error("capability 'deflate' requires 'frames'");
+		}
+
+#ifdef DAIYOUSEI_ZLIB
+		if (capabilities_.deflate_)
+		{
+			deflater_.emplace();
+			inflater_.emplace();
+		}
+#endif
+	}
+	else if (receiving_digests_)
+	{
+		receiving_digests_ = false;
+		last_key_.clear();
+		digests_ = Negotiation::accepted;
+	}
+	else if (communication_status_ != Communication_status::ongoing)
+	{
+		throw std::runtime_error(std::string("unexpected end of list"));
+	}
+	else
+	{
+		communication_status_ = Communication_status::terminated;
+	}
+}
+
+void Session::visit_dictionary_begin()
+{
+	throw std::runtime_error(std::string("unexpected start of dictionary"));
+}
+
+void Session::visit_dictionary_end()
+{
+	throw std::runtime_error(std::string("unexpected end of dictionary"));
+}
+
+std::size_t Session::visit_foreign_data(std::string_view data)
+{
+	if (pending_foreign_data_length() != 0)
+	{
+#ifdef DAIYOUSEI_ZLIB
+		if (frame_compressed_)
+		{
+			inflater_->decompress(data, [this](std::string_view decompressed) -> void
+			{
+				output(frame_fd_, decompressed);
+			});
+			
+			return data.size();
+		}
+#endif
+
+		output(frame_fd_, data);
+		return data.size();
+	}
+	
+	bool compressed = capabilities_.deflate_ and (data[0] & frame_compressed);
+	auto type = compressed ? data[0] & ~frame_compressed : data[0];
+	
+	if (not capabilities_.frames_ or not last_key_.empty() or communication_status_ != Communication_status::ongoing
+		or (type != 1 and type != 2))
+	{
+		return Streaming_deserializer::visit_foreign_data(data);
+	}
+	else if (data.size() < frame_header_size)
+	{
+		return 0;
+	}
+	
+	auto length = std::size_t(0);
+	for (std::size_t i = 0; i != 4; ++i)
+	{
+		length |= std::size_t(std::uint8_t(data[1 + i])) << (8 * i);
+	}
+	
+	frame_fd_ = type;
+	frame_compressed_ = compressed;
+	claim_foreign_data(length);
+	return frame_header_size;
+}
+
+void Session::visit_byte_string(std::string_view value)
+{
+	DAIYOUSEI_PROBE(byte_string, last_key_.c_str(), value.data(), value.size());
+	
+	if (receiving_capabilities_)
+	{
+		auto offered = offered_capabilities_.find(value);
+		
+		if (not offered or not *offered)
+		{
+			throw std::runtime_error(std::string("capability '") + std::string(value) + "' was not offered");
+		}
+		
+		*capabilities_.find(value) = true;
+	}
+	else if (receiving_digests_)
+	{
+		if (value == "argv" and offered_digests_.argv_)
+		{
+			known_digests_.argv_ = true;
+		}
+		else if (value == "env" and offered_digests_.env_)
+		{
+			known_digests_.env_ = true;
+		}
+		else
+		{
+			throw std::runtime_error(std::string("digest '") + std::string(value) + "' was not offered");
+		}
+	}
+	else if (last_key_.empty())
+	{
+		// acknowledgements precede all other values
+		if (not response_started_)
+		{
+			if (value == "capabilities" or (digests_ == Negotiation::pending and value == "digests") or acknowledgement_pending(value))
+			{
+				last_key_ = value;
+				return;
+			}
+			
+			response_started_ = true;
+			reject_pending();
+		}
+		
+		if (value != "exitcode" and value != "stdout" and value != "stderr" and not (capabilities_.cache_ and value == "cache"))
+		{
+			throw std::runtime_error(std::string("key '") + std::string(value) + "' is not valid");
+		}
+		else if (communication_status_ != Communication_status::ongoing)
+		{
+			throw std::runtime_error(std::string("unexpected byte string outside of the response"));
+		}
+		
+		last_key_ = value;
+	}
+	else if (last_key_ == "stdout" or last_key_ == "stderr")
+	{
+		auto fd = last_key_ == "stdout" ? 1 : 2;
+		last_key_.clear();
+		output(fd, value);
+	}
+	else
+	{
+		throw std::runtime_error(std::string("unexpected byte string value for key '" + last_key_ + "'"));
+	}
+}
+
+void Session::visit_integer(bencode::Integer value)
+{
+	DAIYOUSEI_PROBE(integer, last_key_.c_str(), value);
+	
+	if (last_key_.empty())
+	{
+		throw std::runtime_error(std::string("unexpected integer, value: ") + std::to_string(value));
+	}
+	else if (last_key_ == "exitcode")
+	{
+		if (std::exchange(exitcode_, value))
+		{
+			throw std::runtime_error("multiple exit codes set");
+		}
+	}
+	else if (last_key_ == "cache")
+	{
+		cacheable_ = value == 1;
+	}
+	else if (not acknowledge(last_key_, value == 1))
+	{
+		throw std::runtime_error(std::string("unexpected integer value for key '" + last_key_ + "', value: ") + std::to_string(value));
+	}
+	
+	last_key_.clear();
+}
+
+Event_loop::Event_loop(Transport transport)
+	:
+	transport_(std::move(transport)),
+	epoll_fd_(std::experimental::make_unique_resource_checked(epoll_create1(EPOLL_CLOEXEC), -1, &close_fd))
+{
+	if (transport_.type_ != SOCK_STREAM)
+	{
+		throw std::runtime_error(std::string("the event loop supports only stream sockets, requested ") + transport_.name_);
+	}
+	
+	if (epoll_fd_.get() == -1)
+	{
+		throw std::runtime_error(std::string("failed to create epoll instance: ") + std::strerror(errno));
+	}
+}
+
+void Event_loop::start(Session& session)
+{
+	auto& connection = session.connection_;
+	
+	if (connection.status_ != Session::Connection::Status::created)
+	{
+		throw std::logic_error(std::string("the session was already started"));
+	}
+	
+	connection.loop_ = this;
+	connection.status_ = Session::Connection::Status::connecting;
+	connection.backoff_.deadline_ = std::chrono::steady_clock::now() + connect_timeout_;
+	++active_;
+	
+	try
+	{
+		connect(session);
+	}
+	catch (std::exception& ex)
+	{
+		fail(session, ex.what());
+	}
+}
+
+void Event_loop::connect(Session& session)
+{
+	auto& connection = session.connection_;
+	
+	if (connection.socket_.get() == -1)
+	{
+		connection.socket_ = std::experimental::make_unique_resource_checked(
+			socket(transport_.domain_, transport_.type_ | SOCK_NONBLOCK | SOCK_CLOEXEC, 0), -1, &close_fd);
+		
+		if (connection.socket_.get() == -1)
+		{
+			throw std::runtime_error(std::string("failed to create socket: ") + std::strerror(errno));
+		}
+	}
+	
+	connection.retry_time_ = std::chrono::steady_clock::time_point();
+	
+	while (::connect(connection.socket_.get(), reinterpret_cast<sockaddr*>(&transport_.address_), transport_.address_length_) == -1)
+	{
+		if (errno == EINTR)
+		{
+			continue;
+		}
+		else if (errno == EINPROGRESS)
+		{
+			update(session);
+			return;
+		}
+		
+		connection.retry_time_ = connection.backoff_.retry(errno, transport_);
+		retries_.emplace(connection.retry_time_, &session);
+		update(session);
+		return;
+	}
+	
+	connection.status_ = Session::Connection::Status::connected;
+	session.flush_outbound();
+	update(session);
+}
+
+void Event_loop::update(Session& session)
+{
+	auto& connection = session.connection_;
+	auto events = session.wanted_events();
+	
+	if (events == connection.watched_)
+	{
+		return;
+	}
+	
+	auto event = epoll_event();
+	event.events = events;
+	event.data.ptr = &session;
+	
+	auto operation = connection.watched_ == 0 ? EPOLL_CTL_ADD : events == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+	
+	if (epoll_ctl(epoll_fd_.get(), operation, connection.socket_.get(), &event))
+	{
+		throw std::runtime_error(std::string("failed to register the socket to epoll: ") + std::strerror(errno));
+	}
+	
+	connection.watched_ = events;
+}
+
+void Event_loop::handle(Session& session, std::uint32_t events)
+{
+	auto& connection = session.connection_;
+	
+	if (connection.status_ == Session::Connection::Status::connecting)
+	{
+		auto error = int();
+		auto length = socklen_t(sizeof(error));
+		
+		if (getsockopt(connection.socket_.get(), SOL_SOCKET, SO_ERROR, &error, &length) == -1)
+		{
+			throw std::runtime_error(std::string("failed to get the result of connecting: ") + std::strerror(errno));
+		}
+		else if (error != 0)
+		{
+			throw std::runtime_error(std::string("failed to connect to ") + transport_.name_ + ": " + std::strerror(error));
+		}
+		
+		connection.status_ = Session::Connection::Status::connected;
+		events |= EPOLLOUT;
+	}
+	
+	if (events & EPOLLOUT)
+	{
+		session.flush_outbound();
+	}
+	
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+	{
+		receive(session);
+	}
+	
+	if (session.communication_status_ == Session::Communication_status::terminated)
+	{
+		finish(session);
+	}
+	else
+	{
+		update(session);
+	}
+}
+
+void Event_loop::receive(Session& session)
+{
+	auto read_bytes = recv(session.connection_.socket_.get(), receive_buffer_.data(), receive_buffer_.size(), MSG_DONTWAIT);
+	
+	if (read_bytes == -1 and (errno == EWOULDBLOCK or errno == EAGAIN or errno == EINTR))
+	{
+		return;
+	}
+	else if (read_bytes == -1)
+	{
+		throw std::runtime_error(std::string("failed to receive from the server: ") + std::strerror(errno));
+	}
+	else if (read_bytes == 0)
+	{
+		throw std::runtime_error(std::string("communication terminated by the server without sending end of list"));
+	}
+	
+	session.data_.append(receive_buffer_.data(), read_bytes);
+	
+	DAIYOUSEI_PROBE(receive_entry, session.data_.size());
+	session.Streaming_deserializer::receive();
+	DAIYOUSEI_PROBE(receive_return, session.data_.size());
+}
+
+void Event_loop::release(Session& session) noexcept
+{
+	auto& connection = session.connection_;
+	
+	if (connection.status_ == Session::Connection::Status::done)
+	{
+		return;
+	}
+	
+	if (connection.retry_time_ != std::chrono::steady_clock::time_point())
+	{
+		retries_.erase({connection.retry_time_, &session});
+		connection.retry_time_ = std::chrono::steady_clock::time_point();
+	}
+	
+	// closing the socket also removes it from epoll
+	connection.socket_.reset();
+	connection.watched_ = 0;
+	connection.status_ = Session::Connection::Status::done;
+	--active_;
+}
+
+void Event_loop::finish(Session& session)
+{
+	if (not session.exitcode_)
+	{
+		return fail(session, "communication terminated without setting the exit code");
+	}
+	
+	release(session);
+	session.on_exit(int(*session.exitcode_));
+}
+
+void Event_loop::fail(Session& session, std::string_view message)
+{
+	release(session);
+	session.on_error(message);
+}
+
+std::size_t Event_loop::run_once(std::chrono::milliseconds timeout)
+{
+	auto now = std::chrono::steady_clock::now();
+	
+	if (not retries_.empty())
+	{
+		auto until_retry = std::chrono::ceil<std::chrono::milliseconds>(std::max(retries_.begin()->first - now, std::chrono::steady_clock::duration()));
+		
+		// a negative timeout waits indefinitely
+		if (timeout.count() < 0 or until_retry < timeout)
+		{
+			timeout = until_retry;
+		}
+	}
+	
+	auto events = std::array<epoll_event, 256>();
+	auto ready_events = epoll_wait(epoll_fd_.get(), events.data(), int(events.size()), int(timeout.count()));
+	
+	if (ready_events == -1 and errno != EINTR)
+	{
+		throw std::runtime_error(std::string("failed to wait for events: ") + std::strerror(errno));
+	}
+	
+	for (int i = 0; i < ready_events; ++i)
+	{
+		auto& session = *static_cast<Session*>(events[i].data.ptr);
+		
+		try
+		{
+			handle(session, events[i].events);
+		}
+		catch (bencode::Deserialization_exception& ex)
+		{
+			fail(session, std::string("deserialization error: ") + ex.what());
+		}
+		catch (std::exception& ex)
+		{
+			// on_exit threw, the session already has its result
+			if (session.done())
+			{
+				throw;
+			}
+			
+			fail(session, ex.what());
+		}
+	}
+	
+	now = std::chrono::steady_clock::now();
+	
+	while (not retries_.empty() and retries_.begin()->first <= now)
+	{
+		auto& session = *retries_.begin()->second;
+		retries_.erase(retries_.begin());
+		
+		try
+		{
+			connect(session);
+		}
+		catch (std::exception& ex)
+		{
+			fail(session, ex.what());
+		}
+	}
+	
+	return active_;
+}
+
+void Event_loop::run()
+{
+	while (active_ != 0)
+	{
+		run_once(std::chrono::milliseconds(-1));
+	}
+}
+} // namespace daiyousei
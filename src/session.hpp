@@ -0,0 +1,349 @@
+#pragma once
+
+#include <bencode.hpp>
+#include <global.hpp>
+#include <transport.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <optional>
+#include <random>
+#include <set>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <experimental/array>
+#include <experimental/scope>
+
+#ifdef DAIYOUSEI_ZLIB
+#include <compression.hpp>
+#endif
+
+/// The protocol of the client as a library which does not touch the standard streams, the environment
+/// or the working directory of the process, so that any number of calls of the server can share
+/// a single event loop in a single thread. The client program is a session connected to the standard streams
+namespace daiyousei
+{
+struct Event_loop;
+
+/// The call of a program by the server, only read while its request is serialized
+struct Request
+{
+	std::span<const std::string_view> argv_;
+	/// Names and values of the environment variables
+	std::span<const std::pair<std::string_view, std::string_view>> environment_;
+	std::string_view cwd_;
+};
+
+/// Connection attempts refused because the listen backlog of the server is full,
+/// for example when a parallel build calls the server many times at once,
+/// are repeated after a jittered exponential backoff until the deadline
+struct Connect_backoff
+{
+	std::chrono::steady_clock::time_point deadline_;
+	std::chrono::microseconds backoff_ = std::chrono::microseconds(500);
+	/// Number of repeated attempts
+	std::size_t retries_ = 0;
+	/// Seeded by the first retry
+	std::optional<std::minstd_rand> random_;
+	
+	/// Called when connecting to @p transport failed with @p error
+	/// @return The time of the next attempt, throws if connecting gives up
+	std::chrono::steady_clock::time_point retry(int error, const Transport& transport);
+};
+
+/// A single call of the server, the embedding program supplies the standard input
+/// and receives the standard output streams and the exit code through the virtual functions,
+/// which are called from the thread running the event loop
+struct Session : protected bencode::Streaming_deserializer
+{
+	/// Binary frames start with the type, which is the number of the standard stream,
+	/// followed by the payload length as a 32-bit little-endian unsigned integer
+	constexpr static std::size_t frame_header_size = 5;
+	constexpr static std::size_t max_frame_length = std::numeric_limits<std::uint32_t>::max();
+	/// Added to the type of a frame with a compressed payload
+	constexpr static char frame_compressed = char(0x80);
+	
+	/// The request is queued until the session is started
+	explicit Session(const Request& request);
+	
+	Session(const Session&) = delete;
+	Session& operator=(const Session&) = delete;
+	
+	/// A session which is not done is removed from its event loop without calling on_exit or on_error
+	~Session() override;
+	
+	/// Queues a chunk of the standard input, it is sent once the connection is ready
+	void write_stdin(std::string_view data);
+	
+	/// Ends the standard input, which ends the request
+	void close_stdin();
+	
+	/// Whether on_exit or on_error has been called
+	bool done() const noexcept
+	{
+		return connection_.status_ == Connection::Status::done;
+	}
+	
+	/// Number of times connecting was retried because the listen backlog of the server was full
+	std::size_t connect_retries() const noexcept
+	{
+		return connection_.backoff_.retries_;
+	}
+
+protected:
+	/// Optional changes of the encoding offered to the server in the request
+	struct Capabilities
+	{
+		/// Standard streams are sent in binary frames instead of byte strings
+		bool frames_ = false;
+		/// Frames can be compressed, only available if built with zlib
+		bool deflate_ = false;
+		/// The connection is kept for the next request, only offered in batch mode
+		bool batch_ = false;
+		/// The server can mark the response as cacheable, only offered if the response is recorded for the cache
+		bool cache_ = false;
+		
+		constexpr static auto names = std::experimental::make_array<std::string_view>("frames"
+#ifdef DAIYOUSEI_ZLIB
+			, "deflate"
+#endif
+			, "batch"
+			, "cache"
+		);
+		
+		bool* find(std::string_view name) noexcept;
+		
+		static Capabilities all() noexcept;
+		
+		/// Parses a comma-separated list of capability names
+		static Capabilities parse(std::string_view value);
+	};
+	
+	/// State of an optional feature offered to the server
+	enum struct Negotiation
+	{
+		/// Standard input and outputs are forwarded as byte strings
+		disabled,
+		/// The feature was offered, waiting for the server to acknowledge it
+		pending,
+		/// The server uses the feature
+		accepted,
+		/// The server did not acknowledge the feature in time, forwarding as if disabled
+		rejected,
+	};
+	
+	/// Parts of the request the digests of which were offered or which the server knows
+	struct Digests
+	{
+		/// The first DAIYOUSEI_ARGV_PREFIX arguments
+		bool argv_ = false;
+		/// The whole environment
+		bool env_ = false;
+	};
+	
+	enum struct Communication_status
+	{
+		not_started,
+		ongoing,
+		terminated,
+	};
+	
+	constexpr static std::size_t max_stdin_header_length = 7 + std::numeric_limits<std::size_t>::digits10 + 1 + 1;
+	
+	bencode::Serializer::Serializer_buffer serializer_;
+	
+	/// None are offered unless the derived session offers them
+	Capabilities offered_capabilities_;
+	/// Capabilities acknowledged by the server
+	Capabilities capabilities_;
+	
+	/// Standard output stream of the frame the payload of which is being received
+	int frame_fd_ = 0;
+	bool frame_compressed_ = false;
+
+#ifdef DAIYOUSEI_ZLIB
+	/// Created when the server acknowledges compression
+	std::optional<compression::Deflater> deflater_;
+	std::optional<compression::Inflater> inflater_;
+	/// Standard input chunks shorter than this are sent uncompressed
+	std::size_t compression_threshold_ = 4096;
+	std::string compressed_;
+#endif
+
+	Negotiation digests_ = Negotiation::disabled;
+	Digests offered_digests_;
+	Digests known_digests_;
+	
+	Communication_status communication_status_ = Communication_status::not_started;
+	std::string last_key_;
+	std::optional<bencode::Integer> exitcode_;
+	/// Set when the server marks the response as cacheable
+	bool cacheable_ = false;
+	bool stdin_closed_ = false;
+	
+	/// For a session which drives its connection itself, it serializes the request
+	Session();
+	
+	virtual void on_stdout([[maybe_unused]] std::string_view data) {}
+	virtual void on_stderr([[maybe_unused]] std::string_view data) {}
+	
+	/// Called when the server ends the response, an exception it throws propagates out of Event_loop::run_once
+	virtual void on_exit([[maybe_unused]] int exitcode) {}
+	
+	/// Called instead of on_exit if the communication fails, may be called from Event_loop::start
+	virtual void on_error([[maybe_unused]] std::string_view message) {}
+	
+	/// Sends the concatenation of @p parts, by default they are queued for the event loop
+	virtual void send(std::initializer_list<std::string_view> parts);
+	
+	/// Whether the derived session waits for the server to acknowledge the feature @p key
+	virtual bool acknowledgement_pending([[maybe_unused]] std::string_view key) const noexcept
+	{
+		return false;
+	}
+	
+	/// Called for the integer which acknowledges the feature @p key of the derived session
+	/// @return False if the feature was not offered
+	virtual bool acknowledge([[maybe_unused]] std::string_view key, [[maybe_unused]] bool accepted)
+	{
+		return false;
+	}
+	
+	/// Called when the response starts, a server which does not support an offered feature ignores it
+	virtual void reject_pending();
+	
+	/// Appends the digests of the first @p argv_prefix arguments and of the environment to the serializer,
+	/// they start the request so that it is the same as without them if the server does not answer
+	void serialize_digests(const Request& request, std::size_t argv_prefix);
+	
+	/// Appends the request up to the standard input to the serializer,
+	/// the parts which the server knows by their digests are left out
+	void serialize_request(const Request& request, std::size_t argv_prefix = 0);
+	
+	/// Formats the header of a standard input chunk of @p length bytes into @p buffer
+	std::string_view stdin_header(std::array<char, max_stdin_header_length>& buffer, std::size_t length, bool compressed = false) const noexcept;
+	
+	/// Sends @p data in standard input chunks which fit into messages of @p max_message_size bytes
+	void send_stdin_chunks(std::string_view data, std::size_t max_message_size);
+
+private:
+	friend Event_loop;
+	
+	bool receiving_capabilities_ = false;
+	bool receiving_digests_ = false;
+	bool response_started_ = false;
+	
+	/// The connection of a session driven by an event loop
+	struct Connection
+	{
+		enum struct Status
+		{
+			created,
+			/// Waiting for a connection in progress or for the time to retry connecting
+			connecting,
+			connected,
+			done,
+		}
+		status_ = Status::created;
+		
+		Event_loop* loop_ = nullptr;
+		std::experimental::unique_resource<int, void(*)(int)> socket_;
+		/// Events the socket is registered for in the event loop
+		std::uint32_t watched_ = 0;
+		
+		/// The serialized data which were not yet sent, it already holds the request before the session is started
+		std::string outbound_;
+		bool shut_down_ = false;
+		
+		Connect_backoff backoff_;
+		std::chrono::steady_clock::time_point retry_time_;
+	}
+	connection_;
+	
+	void visit_list_begin() override;
+	void visit_list_end() override;
+	void visit_dictionary_begin() override;
+	void visit_dictionary_end() override;
+	void visit_byte_string(std::string_view value) override;
+	void visit_integer(bencode::Integer value) override;
+	
+	/// Receives binary frames of the standard output streams once the server has acknowledged them
+	std::size_t visit_foreign_data(std::string_view data) override;
+	
+	/// Passes @p data to on_stdout or on_stderr
+	void output(int fd, std::string_view data);
+	
+	/// @return The events the socket should be registered for in the current state
+	std::uint32_t wanted_events() const noexcept;
+	
+	/// Sends as much of the outbound data as the socket accepts
+	void flush_outbound();
+};
+
+/// Drives the connections of any number of sessions by a single epoll(7) instance
+struct Event_loop
+{
+	Transport transport_;
+	/// Connecting gives up after this time, connections refused because the listen backlog
+	/// of the server is full are retried until then
+	std::chrono::milliseconds connect_timeout_ = std::chrono::milliseconds(10'000);
+	
+	/// @param transport Only stream sockets are supported
+	explicit Event_loop(Transport transport);
+	
+	Event_loop(const Event_loop&) = delete;
+	Event_loop& operator=(const Event_loop&) = delete;
+	
+	/// Connects the session and sends its request, the session must not be moved until it is done
+	/// and it must be done or destroyed before the event loop is destroyed
+	void start(Session& session);
+	
+	/// Handles the events until all the started sessions are done,
+	/// the functions of the sessions may start other sessions meanwhile
+	void run();
+	
+	/// Waits at most @p timeout for events and handles them
+	/// @return The number of started sessions which are not done
+	std::size_t run_once(std::chrono::milliseconds timeout);
+	
+	/// Number of started sessions which are not done
+	std::size_t active() const noexcept
+	{
+		return active_;
+	}
+
+private:
+	friend Session;
+	
+	std::experimental::unique_resource<int, void(*)(int)> epoll_fd_;
+	std::size_t active_ = 0;
+	/// Sessions waiting to retry connecting ordered by the time of the next attempt
+	std::set<std::pair<std::chrono::steady_clock::time_point, Session*>> retries_;
+	/// Shared by all sessions, the response is parsed as soon as it is received
+	std::vector<char> receive_buffer_ = std::vector<char>(64 * 1024);
+	
+	/// Attempts to connect, schedules a retry if the listen backlog of the server is full
+	void connect(Session& session);
+	
+	/// Registers the socket of the session for the events its state needs
+	void update(Session& session);
+	
+	/// Handles the events reported for the socket of the session
+	void handle(Session& session, std::uint32_t events);
+	
+	/// Receives from the socket of the session and parses the response
+	void receive(Session& session);
+	
+	/// Closes the connection of the session, which is done afterwards
+	void release(Session& session) noexcept;
+	
+	void finish(Session& session);
+	void fail(Session& session, std::string_view message);
+};
+} // namespace daiyousei
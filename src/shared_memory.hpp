@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <span>
+#include <utility>
+
+/// Single-producer single-consumer byte rings in a file shared by the client and the server.
+/// All values are in the native byte order.
+namespace shared_memory
+{
+/// Offsets of the control values in the shared file, each on its own cache line
+namespace offset
+{
+/// Total number of bytes written to the standard input ring by the client
+constexpr std::size_t stdin_head = 0;
+/// Total number of bytes consumed from the standard input ring by the server
+constexpr std::size_t stdin_tail = 64;
+/// Total number of bytes written to the output ring by the server
+constexpr std::size_t output_head = 128;
+/// Total number of bytes consumed from the output ring by the client
+constexpr std::size_t output_tail = 192;
+/// Nonzero if the client waits to be woken up by its event file descriptor
+constexpr std::size_t client_waiting = 256;
+/// Nonzero if the server waits to be woken up by its event file descriptor
+constexpr std::size_t server_waiting = 320;
+/// Data of the standard input ring followed by the data of the output ring
+constexpr std::size_t data = 4096;
+}
+
+/// Each record in the output ring starts with the output file descriptor number
+/// and the length of the payload, both as 32-bit unsigned integers
+constexpr std::size_t record_header_size = 8;
+
+constexpr bool is_valid_ring_size(std::size_t size) noexcept
+{
+	return size >= 4096 and (size & (size - 1)) == 0;
+}
+
+constexpr std::size_t file_size(std::size_t ring_size) noexcept
+{
+	return offset::data + 2 * ring_size;
+}
+
+inline std::atomic_ref<std::uint64_t> counter(char* mapping, std::size_t offset) noexcept
+{
+	return std::atomic_ref<std::uint64_t>(*reinterpret_cast<std::uint64_t*>(mapping + offset));
+}
+
+inline std::atomic_ref<std::uint32_t> flag(char* mapping, std::size_t offset) noexcept
+{
+	return std::atomic_ref<std::uint32_t>(*reinterpret_cast<std::uint32_t*>(mapping + offset));
+}
+
+/// One side of a ring, the producer only calls the writing functions
+/// and the consumer only calls the reading functions
+struct Ring
+{
+	std::atomic_ref<std::uint64_t> head_;
+	std::atomic_ref<std::uint64_t> tail_;
+	char* data_;
+	std::size_t size_;
+	
+	Ring(char* mapping, std::size_t head, std::size_t tail, std::size_t data, std::size_t size) noexcept
+		:
+		head_(counter(mapping, head)),
+		tail_(counter(mapping, tail)),
+		data_(mapping + data),
+		size_(size)
+	{
+	}
+	
+	std::size_t readable() const noexcept
+	{
+		return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_relaxed);
+	}
+	
+	std::size_t writable() const noexcept
+	{
+		return size_ - (head_.load(std::memory_order_relaxed) - tail_.load(std::memory_order_acquire));
+	}
+	
+	/// @return The free space following the head, split in two if it wraps around
+	std::array<std::span<char>, 2> writable_spans() const noexcept
+	{
+		auto position = head_.load(std::memory_order_relaxed) & (size_ - 1);
+		auto length = writable();
+		auto first = std::min(length, size_ - position);
+		return {std::span(data_ + position, first), std::span(data_, length - first)};
+	}
+	
+	/// @return The data following the tail, split in two if it wraps around
+	std::array<std::span<const char>, 2> readable_spans() const noexcept
+	{
+		auto position = tail_.load(std::memory_order_relaxed) & (size_ - 1);
+		auto length = readable();
+		auto first = std::min(length, size_ - position);
+		return {std::span<const char>(data_ + position, first), std::span<const char>(data_, length - first)};
+	}
+	
+	void produce(std::size_t length) noexcept
+	{
+		head_.store(head_.load(std::memory_order_relaxed) + length, std::memory_order_release);
+	}
+	
+	void consume(std::size_t length) noexcept
+	{
+		tail_.store(tail_.load(std::memory_order_relaxed) + length, std::memory_order_release);
+	}
+	
+	/// Copies exactly @p output.size() bytes which must be readable, without consuming them
+	void peek(std::span<char> output) const noexcept
+	{
+		auto spans = readable_spans();
+		auto first = std::min(output.size(), spans[0].size());
+		std::ranges::copy(spans[0].first(first), output.begin());
+		std::ranges::copy(spans[1].first(output.size() - first), output.begin() + first);
+	}
+};
+}
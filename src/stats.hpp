@@ -0,0 +1,270 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <experimental/array>
+#include <experimental/scope>
+
+#include <hash.hpp>
+
+/// Histograms of the invocations of all clients in a file shared by them, each client adds its values
+/// by atomic increments without any lock. Each program occupies a single page, so that an invocation
+/// only faults in one page for writing. All values are in the native byte order.
+namespace stats
+{
+/// Identifies the layout, a file with a different value is left untouched
+constexpr std::uint64_t magic = 0x3174'6174'7379'6164;
+
+/// Longer program names are cut off
+constexpr std::size_t max_name_length = 48;
+
+/// Each power of two is split into this many buckets, so the upper bound of a bucket is at most
+/// 25 % above any value in it, values below it have a bucket each
+constexpr std::size_t sub_buckets = 4;
+constexpr std::size_t sub_bucket_bits = std::countr_zero(sub_buckets);
+/// Values of at least 2^40, which is about 12 days in microseconds, share the last bucket
+constexpr std::size_t max_exponent = 40;
+constexpr std::size_t bucket_count = (max_exponent - sub_bucket_bits + 1) * sub_buckets + 1;
+
+constexpr std::size_t bucket_index(std::uint64_t value) noexcept
+{
+	if (value < sub_buckets)
+	{
+		return value;
+	}
+	
+	auto exponent = std::size_t(std::bit_width(value)) - 1;
+	
+	if (exponent >= max_exponent)
+	{
+		return bucket_count - 1;
+	}
+	
+	auto sub_bucket = std::size_t(value >> (exponent - sub_bucket_bits)) & (sub_buckets - 1);
+	return (exponent - sub_bucket_bits + 1) * sub_buckets + sub_bucket;
+}
+
+/// @return The smallest value in the bucket
+constexpr std::uint64_t bucket_lower_bound(std::size_t index) noexcept
+{
+	if (index < sub_buckets)
+	{
+		return index;
+	}
+	
+	auto exponent = index / sub_buckets + sub_bucket_bits - 1;
+	return std::uint64_t(sub_buckets + index % sub_buckets) << (exponent - sub_bucket_bits);
+}
+
+/// @return The largest value in the bucket
+constexpr std::uint64_t bucket_upper_bound(std::size_t index) noexcept
+{
+	return index + 1 == bucket_count ? std::uint64_t(-1) : bucket_lower_bound(index + 1) - 1;
+}
+
+enum struct Metric
+{
+	/// Microseconds from the start of the client until it is connected
+	connect,
+	/// Microseconds from the start of the client until the first bytes of the response are received
+	first_byte,
+	/// Microseconds from the start of the client until the communication has ended
+	total,
+	bytes_sent,
+	bytes_received,
+};
+
+constexpr auto metric_names = std::experimental::make_array<std::string_view>(
+	"connect_us", "first_byte_us", "total_us", "bytes_sent", "bytes_received"
+);
+
+struct Histogram
+{
+	std::uint64_t count_;
+	std::uint64_t sum_;
+	std::array<std::uint32_t, bucket_count> buckets_;
+	
+	/// @return The upper bound of the bucket containing the value below which the fraction @p quantile of the values lie
+	std::uint64_t quantile(double quantile) const noexcept
+	{
+		auto rank = std::uint64_t(quantile * double(count_));
+		auto seen = std::uint64_t(0);
+		
+		for (std::size_t i = 0; i != bucket_count; ++i)
+		{
+			seen += buckets_[i];
+			
+			if (seen > rank)
+			{
+				return bucket_upper_bound(i);
+			}
+		}
+		
+		return 0;
+	}
+};
+
+/// The histograms of the invocations of one program, identified by the file name of argv[0]
+struct alignas(4096) Program
+{
+	/// Hash of the name, zero if the slot is free
+	std::uint64_t key_;
+	/// Written after the slot is claimed, null-terminated unless it fills the whole array
+	std::array<char, max_name_length> name_;
+	std::uint64_t invocations_;
+	/// Invocations which did not receive an exit code
+	std::uint64_t failures_;
+	std::array<Histogram, metric_names.size()> histograms_;
+	
+	std::string_view name() const noexcept
+	{
+		return std::string_view(name_.data(), std::find(name_.begin(), name_.end(), '\0'));
+	}
+};
+
+static_assert(sizeof(Program) == 4096);
+
+struct File
+{
+	alignas(4096) std::uint64_t magic_;
+	std::array<Program, 64> programs_;
+};
+
+using Mapping = std::experimental::unique_resource<File*, void(*)(File*)>;
+
+/// Maps the file, which is created and extended to its full size if it is empty,
+/// several clients may do so at once because the new parts of the file are zeros
+/// @return A null mapping if the file cannot be used, errno is zero if it is not a statistics file
+inline Mapping map(const char* path, bool create) noexcept
+{
+	auto fail = Mapping(nullptr, +[](File*) -> void {});
+	auto fd = std::experimental::make_unique_resource_checked(open(path, (create ? O_RDWR | O_CREAT : O_RDONLY) | O_CLOEXEC, 0644), -1, +[](int fd) -> void
+	{
+		close(fd);
+	});
+	struct stat file_stat;
+	
+	if (fd.get() == -1 or fstat(fd.get(), &file_stat))
+	{
+		return fail;
+	}
+	
+	if (file_stat.st_size == 0 and create)
+	{
+		if (ftruncate(fd.get(), sizeof(File)))
+		{
+			return fail;
+		}
+	}
+	else if (std::size_t(file_stat.st_size) < sizeof(File))
+	{
+		errno = 0;
+		return fail;
+	}
+	
+	auto mapping = mmap(nullptr, sizeof(File), create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd.get(), 0);
+	
+	if (mapping == MAP_FAILED)
+	{
+		return fail;
+	}
+	
+	auto file = static_cast<File*>(mapping);
+	auto expected = std::atomic_ref(file->magic_).load(std::memory_order_relaxed);
+	
+	// only a new file is written, so that the clients do not fault in its first page for writing
+	if (create and expected == 0)
+	{
+		std::atomic_ref(file->magic_).compare_exchange_strong(expected, magic, std::memory_order_relaxed);
+	}
+	
+	if (expected != 0 and expected != magic)
+	{
+		munmap(mapping, sizeof(File));
+		errno = 0;
+		return fail;
+	}
+	
+	return Mapping(file, +[](File* file) -> void
+	{
+		munmap(file, sizeof(File));
+	});
+}
+
+/// @return The slot of the program, claimed if it is not yet in the file, or null if the file is full
+inline Program* find(File& file, std::string_view name, bool claim) noexcept
+{
+	name = name.substr(0, max_name_length);
+	auto hash = Hash();
+	hash.update(name);
+	auto key = std::max(hash.low_, std::uint64_t(1));
+	
+	for (std::size_t i = 0; i != file.programs_.size(); ++i)
+	{
+		auto& program = file.programs_[(key + i) % file.programs_.size()];
+		auto current = std::atomic_ref(program.key_).load(std::memory_order_relaxed);
+		
+		if (current == 0 and claim and std::atomic_ref(program.key_).compare_exchange_strong(current, key, std::memory_order_relaxed))
+		{
+			std::copy(name.begin(), name.end(), program.name_.begin());
+			return &program;
+		}
+		else if (current == key)
+		{
+			return &program;
+		}
+		else if (current == 0)
+		{
+			return nullptr;
+		}
+	}
+	
+	return nullptr;
+}
+
+/// Adds an invocation of the program @p name to the file @p path, failures to use the file are ignored
+/// @param values Indexed by Metric, nothing for the phases which were not reached
+inline void record(const char* path, std::string_view name, bool failed, std::span<const std::optional<std::uint64_t>, metric_names.size()> values) noexcept
+{
+	auto file = map(path, true);
+	auto program = file.get() ? find(*file.get(), name, true) : nullptr;
+	
+	if (program == nullptr)
+	{
+		return;
+	}
+	
+	std::atomic_ref(program->invocations_).fetch_add(1, std::memory_order_relaxed);
+	
+	if (failed)
+	{
+		std::atomic_ref(program->failures_).fetch_add(1, std::memory_order_relaxed);
+	}
+	
+	for (std::size_t i = 0; i != values.size(); ++i)
+	{
+		if (auto value = values[i])
+		{
+			auto& histogram = program->histograms_[i];
+			std::atomic_ref(histogram.count_).fetch_add(1, std::memory_order_relaxed);
+			std::atomic_ref(histogram.sum_).fetch_add(*value, std::memory_order_relaxed);
+			std::atomic_ref(histogram.buckets_[bucket_index(*value)]).fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+}
+} // namespace stats
@@ -0,0 +1,170 @@
+#include <stats.hpp>
+#include <global.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <string>
+#include <string_view>
+
+/// Prints the percentiles and the mean of each metric of each program
+static void print_percentiles(const stats::File& file)
+{
+	std::printf("%-24s %12s %10s  %-16s %10s %10s %10s %10s %12s\n", "program", "invocations", "failures", "metric", "count", "p50", "p90", "p99", "mean");
+	
+	for (const auto& program : file.programs_)
+	{
+		if (program.key_ == 0)
+		{
+			continue;
+		}
+		
+		auto name = std::string(program.name());
+		
+		for (std::size_t i = 0; i != program.histograms_.size(); ++i)
+		{
+			const auto& histogram = program.histograms_[i];
+			
+			if (histogram.count_ == 0)
+			{
+				continue;
+			}
+			
+			std::printf("%-24s %12llu %10llu  %-16s %10llu %10llu %10llu %10llu %12llu\n", name.c_str(),
+				static_cast<unsigned long long>(program.invocations_), static_cast<unsigned long long>(program.failures_),
+				stats::metric_names[i].data(), static_cast<unsigned long long>(histogram.count_),
+				static_cast<unsigned long long>(histogram.quantile(0.5)), static_cast<unsigned long long>(histogram.quantile(0.9)),
+				static_cast<unsigned long long>(histogram.quantile(0.99)), static_cast<unsigned long long>(histogram.sum_ / histogram.count_));
+		}
+	}
+}
+
+/// @return The program name as a label value, with the characters escaped that the format requires
+static std::string label(std::string_view value)
+{
+	auto result = std::string("program=\"");
+	
+	for (char c : value)
+	{
+		if (c == '\\' or c == '"')
+		{
+			result += '\\';
+			result += c;
+		}
+		else if (c == '\n')
+		{
+			result += "\\n";
+		}
+		else
+		{
+			result += c;
+		}
+	}
+	
+	return result + '"';
+}
+
+/// Only the buckets which hold any values are listed, the counts are cumulative as the format requires
+static void print_prometheus(const stats::File& file)
+{
+	std::printf("# HELP daiyousei_invocations_total Invocations of the client\n# TYPE daiyousei_invocations_total counter\n");
+	
+	for (const auto& program : file.programs_)
+	{
+		if (program.key_ != 0)
+		{
+			std::printf("daiyousei_invocations_total{%s} %llu\n", label(program.name()).c_str(), static_cast<unsigned long long>(program.invocations_));
+		}
+	}
+	
+	std::printf("# HELP daiyousei_failures_total Invocations of the client which did not receive an exit code\n# TYPE daiyousei_failures_total counter\n");
+	
+	for (const auto& program : file.programs_)
+	{
+		if (program.key_ != 0)
+		{
+			std::printf("daiyousei_failures_total{%s} %llu\n", label(program.name()).c_str(), static_cast<unsigned long long>(program.failures_));
+		}
+	}
+	
+	for (std::size_t i = 0; i != stats::metric_names.size(); ++i)
+	{
+		auto metric = std::string("daiyousei_") + std::string(stats::metric_names[i]);
+		std::printf("# TYPE %s histogram\n", metric.c_str());
+		
+		for (const auto& program : file.programs_)
+		{
+			if (program.key_ == 0)
+			{
+				continue;
+			}
+			
+			const auto& histogram = program.histograms_[i];
+			auto program_label = label(program.name());
+			auto cumulative = std::uint64_t(0);
+			
+			for (std::size_t bucket = 0; bucket + 1 != stats::bucket_count; ++bucket)
+			{
+				if (histogram.buckets_[bucket] != 0)
+				{
+					cumulative += histogram.buckets_[bucket];
+					std::printf("%s_bucket{%s,le=\"%llu\"} %llu\n", metric.c_str(), program_label.c_str(),
+						static_cast<unsigned long long>(stats::bucket_upper_bound(bucket)), static_cast<unsigned long long>(cumulative));
+				}
+			}
+			
+			std::printf("%s_bucket{%s,le=\"+Inf\"} %llu\n", metric.c_str(), program_label.c_str(), static_cast<unsigned long long>(histogram.count_));
+			std::printf("%s_sum{%s} %llu\n", metric.c_str(), program_label.c_str(), static_cast<unsigned long long>(histogram.sum_));
+			std::printf("%s_count{%s} %llu\n", metric.c_str(), program_label.c_str(), static_cast<unsigned long long>(histogram.count_));
+		}
+	}
+}
+
+int main(int argc, const char* const* argv)
+{
+	auto prometheus = false;
+	const char* path = std::getenv(global::env_name_stats_file.data());
+	
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--prometheus") == 0)
+		{
+			prometheus = true;
+		}
+		else if (argv[i][0] == '-')
+		{
+			global::report({"unknown option: ", argv[i]});
+			return 2;
+		}
+		else
+		{
+			path = argv[i];
+		}
+	}
+	
+	if (path == nullptr)
+	{
+		global::report({"usage: daiyousei-stats [--prometheus] [file], the file defaults to ", global::env_name_stats_file});
+		return 2;
+	}
+	
+	auto file = stats::map(path, false);
+	
+	if (file.get() == nullptr)
+	{
+		global::report({"failed to map the statistics file ", path, ": ", errno ? std::strerror(errno) : "not a statistics file of this version"});
+		return 1;
+	}
+	
+	if (prometheus)
+	{
+		print_prometheus(*file.get());
+	}
+	else
+	{
+		print_percentiles(*file.get());
+	}
+	
+	return 0;
+}
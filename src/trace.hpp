@@ -0,0 +1,207 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <experimental/array>
+
+#include <global.hpp>
+
+/// Timestamps of the phases of a single invocation written as one JSON line to the file or the file descriptor
+/// named by DAIYOUSEI_TRACE, so that the latency of a slow call can be attributed to the client, the connection
+/// or the server. The timestamps are taken from the monotonic clock and are relative to the start of the client.
+/// The same timestamps are added to the histograms in the file named by DAIYOUSEI_STATS_FILE
+struct Trace
+{
+	enum struct Phase
+	{
+		/// The connection to the server is established
+		connected,
+		/// The whole request header has been handed to the kernel
+		request_sent,
+		/// The first bytes of the response have been received
+		first_byte,
+		/// The exit code has been received
+		exit_code,
+		/// The end of the response has been received
+		end_of_list,
+		/// The outputs have been written and the communication has ended
+		finished,
+	};
+	
+	constexpr static auto phase_names = std::experimental::make_array<std::string_view>(
+		"connect_us", "request_sent_us", "first_byte_us", "exit_code_us", "end_of_list_us", "finished_us"
+	);
+	
+	std::chrono::steady_clock::time_point start_ = std::chrono::steady_clock::now();
+	std::chrono::system_clock::time_point wall_start_ = std::chrono::system_clock::now();
+	std::array<std::optional<std::chrono::steady_clock::time_point>, phase_names.size()> phases_;
+	/// The path of the trace file or "fd:" followed by the number of an open file descriptor, empty if no line is written
+	std::string_view destination_;
+	/// The path of the shared file with the histograms of all invocations
+	const char* stats_path_ = nullptr;
+	/// Number of times the received data were parsed
+	std::size_t receive_calls_ = 0;
+	/// The largest amount of received data waiting to be parsed
+	std::size_t peak_buffer_size_ = 0;
+	
+	/// @return Nothing if neither DAIYOUSEI_TRACE nor DAIYOUSEI_STATS_FILE is defined and nonempty
+	static std::optional<Trace> from_env() noexcept
+	{
+		auto destination = std::getenv(global::env_name_trace.data());
+		auto stats_path = std::getenv(global::env_name_stats_file.data());
+		
+		if ((destination == nullptr or *destination == '\0') and (stats_path == nullptr or *stats_path == '\0'))
+		{
+			return std::nullopt;
+		}
+		
+		auto result = Trace();
+		result.destination_ = destination ? destination : "";
+		result.stats_path_ = stats_path and *stats_path ? stats_path : nullptr;
+		return result;
+	}
+	
+	/// @return The microseconds from the start until @p phase, nothing if it was not reached
+	std::optional<std::uint64_t> elapsed(Phase phase) const noexcept
+	{
+		if (auto time = phases_[std::size_t(phase)])
+		{
+			return std::chrono::duration_cast<std::chrono::microseconds>(*time - start_).count();
+		}
+		
+		return std::nullopt;
+	}
+	
+	/// Records the time of @p phase, only its first occurrence counts
+	void mark(Phase phase) noexcept
+	{
+		if (auto& time = phases_[std::size_t(phase)]; not time)
+		{
+			time = std::chrono::steady_clock::now();
+		}
+	}
+	
+	/// Called before @p size bytes of received data are parsed
+	void parsing(std::size_t size) noexcept
+	{
+		++receive_calls_;
+		peak_buffer_size_ = std::max(peak_buffer_size_, size);
+	}
+	
+	/// Members of the JSON object, the numbers and the null values are written as they are
+	struct Line
+	{
+		std::string text_ = "{";
+		
+		void raw_field(std::string_view name, std::string_view value)
+		{
+			text_ += text_.size() == 1 ? "\"" : ",\"";
+			text_ += name;
+			text_ += "\":";
+			text_ += value;
+		}
+		
+		void field(std::string_view name, std::size_t value)
+		{
+			raw_field(name, std::to_string(value));
+		}
+		
+		void string_field(std::string_view name, std::string_view value)
+		{
+			auto escaped = std::string("\"");
+			
+			for (char c : value)
+			{
+				if (c == '"' or c == '\\')
+				{
+					escaped += '\\';
+					escaped += c;
+				}
+				else if (std::uint8_t(c) < 0x20)
+				{
+					constexpr auto digits = std::string_view("0123456789abcdef");
+					escaped += "\\u00";
+					escaped += digits[std::uint8_t(c) >> 4];
+					escaped += digits[std::uint8_t(c) & 0xf];
+				}
+				else
+				{
+					escaped += c;
+				}
+			}
+			
+			escaped += '"';
+			raw_field(name, escaped);
+		}
+	};
+	
+	/// @return The line starting with the wall clock time of the start and the pid of the client
+	Line begin_line() const
+	{
+		auto result = Line();
+		result.field("time_us", std::chrono::duration_cast<std::chrono::microseconds>(wall_start_.time_since_epoch()).count());
+		result.field("pid", std::size_t(getpid()));
+		return result;
+	}
+	
+	/// Completes @p line with the phases and appends it to the destination, failures are only reported
+	/// because the trace must not change the outcome of the invocation
+	void write(Line line) noexcept
+	{
+		try
+		{
+			for (std::size_t i = 0; i != phases_.size(); ++i)
+			{
+				auto time = elapsed(Phase(i));
+				line.raw_field(phase_names[i], time ? std::to_string(*time) : "null");
+			}
+			
+			line.text_ += "}\n";
+			
+			auto fd = -1;
+			auto owned = false;
+			
+			if (auto number = destination_.substr(std::min(destination_.size(), std::size_t(3))); destination_.starts_with("fd:"))
+			{
+				if (auto [end, error] = std::from_chars(number.data(), number.data() + number.size(), fd); error != std::errc() or end != number.data() + number.size())
+				{
+					global::report({"invalid trace file descriptor: ", destination_});
+					return;
+				}
+			}
+			else
+			{
+				// appending keeps the lines of concurrent clients whole
+				fd = open(std::string(destination_).c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+				owned = true;
+			}
+			
+			auto result = fd == -1 ? -1 : ::write(fd, line.text_.data(), line.text_.size());
+			
+			if (result != ssize_t(line.text_.size()))
+			{
+				global::report({"failed to write the trace to ", destination_, ": ", result == -1 ? std::strerror(errno) : "short write"});
+			}
+			
+			if (owned and fd != -1)
+			{
+				close(fd);
+			}
+		}
+		catch (std::exception&)
+		{
+		}
+	}
+};
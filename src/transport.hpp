@@ -0,0 +1,199 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <charconv>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <experimental/scope>
+
+#include <global.hpp>
+
+/// Address of the server and the type of the socket used to reach it
+struct Transport
+{
+	int domain_ = AF_UNIX;
+	int type_ = SOCK_STREAM;
+	sockaddr_storage address_ {};
+	socklen_t address_length_ = 0;
+	/// Description used in error messages
+	std::string name_;
+	/// File path of the socket, empty unless it is a Unix domain socket in the file system
+	std::string path_;
+	
+	static Transport unix_socket(std::string_view path, int type)
+	{
+		auto result = Transport();
+		auto& address = reinterpret_cast<sockaddr_un&>(result.address_);
+		
+		if (path.size() >= std::size(address.sun_path))
+		{
+			throw std::runtime_error(std::string("unix socket path too long, value is: ") + std::string(path));
+		}
+		
+		address.sun_family = AF_UNIX;
+		std::ranges::copy(path, address.sun_path);
+		result.type_ = type;
+		result.address_length_ = sizeof(sockaddr_un);
+		result.name_ = "unix socket " + std::string(path);
+		result.path_ = path;
+		return result;
+	}
+	
+	/// Abstract socket names start with a null byte and do not exist in the file system
+	static Transport abstract_unix_socket(std::string_view name, int type)
+	{
+		auto result = Transport();
+		auto& address = reinterpret_cast<sockaddr_un&>(result.address_);
+		
+		if (name.size() + 1 > std::size(address.sun_path))
+		{
+			throw std::runtime_error(std::string("abstract unix socket name too long, value is: ") + std::string(name));
+		}
+		
+		address.sun_family = AF_UNIX;
+		std::ranges::copy(name, address.sun_path + 1);
+		result.type_ = type;
+		result.address_length_ = offsetof(sockaddr_un, sun_path) + 1 + name.size();
+		result.name_ = "abstract unix socket @" + std::string(name);
+		return result;
+	}
+	
+	/// @param host_port In the format <host>:<port>, IPv6 addresses may be enclosed in square brackets
+	static Transport tcp_socket(std::string_view host_port)
+	{
+		auto separator = host_port.rfind(':');
+		if (separator == std::string_view::npos)
+		{
+			throw std::runtime_error(std::string("invalid TCP address, expected <host>:<port>, value is: ") + std::string(host_port));
+		}
+		
+		auto host = std::string(host_port.substr(0, separator));
+		auto port = std::string(host_port.substr(separator + 1));
+		
+		if (host.size() >= 2 and host.front() == '[' and host.back() == ']')
+		{
+			host = host.substr(1, host.size() - 2);
+		}
+		
+		auto result = Transport();
+		result.type_ = SOCK_STREAM;
+		result.name_ = "TCP socket " + std::string(host_port);
+
+#ifdef DAIYOUSEI_NUMERIC_HOSTS
+		// host names are not resolved because getaddrinfo(3) loads the NSS modules of the C library
+		// at run time, which a statically linked client cannot rely on
+		auto port_number = std::uint16_t();
+		auto& ipv4 = reinterpret_cast<sockaddr_in&>(result.address_);
+		auto& ipv6 = reinterpret_cast<sockaddr_in6&>(result.address_);
+		
+		if (auto [end, error] = std::from_chars(port.data(), port.data() + port.size(), port_number); error != std::errc() or end != port.data() + port.size())
+		{
+			throw std::runtime_error(std::string("invalid TCP port, value is: ") + std::string(host_port));
+		}
+		else if (inet_pton(AF_INET, host.c_str(), &ipv4.sin_addr) == 1)
+		{
+			ipv4.sin_family = AF_INET;
+			ipv4.sin_port = htons(port_number);
+			result.address_length_ = sizeof(ipv4);
+		}
+		else if (inet_pton(AF_INET6, host.c_str(), &ipv6.sin6_addr) == 1)
+		{
+			ipv6.sin6_family = AF_INET6;
+			ipv6.sin6_port = htons(port_number);
+			result.address_length_ = sizeof(ipv6);
+		}
+		else
+		{
+			throw std::runtime_error(std::string("this client accepts only numeric TCP addresses, value is: ") + std::string(host_port));
+		}
+		
+		result.domain_ = result.address_.ss_family;
+#else
+		auto hints = addrinfo();
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_NUMERICSERV;
+		auto addresses = static_cast<addrinfo*>(nullptr);
+		
+		if (auto error = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses))
+		{
+			throw std::runtime_error(std::string("failed to resolve TCP address ") + std::string(host_port) + ": " + gai_strerror(error));
+		}
+		
+		auto addresses_guard = std::experimental::unique_resource(addresses, &freeaddrinfo);
+		
+		result.domain_ = addresses->ai_family;
+		std::memcpy(&result.address_, addresses->ai_addr, addresses->ai_addrlen);
+		result.address_length_ = addresses->ai_addrlen;
+#endif
+
+		return result;
+	}
+	
+	/// Parses the value of DAIYOUSEI_SOCKET
+	static Transport parse(std::string_view uri)
+	{
+		auto separator = uri.find(':');
+		// a value without a separator matches no scheme
+		auto scheme = separator == std::string_view::npos ? std::string_view() : uri.substr(0, separator);
+		auto rest = separator == std::string_view::npos ? std::string_view() : uri.substr(separator + 1);
+		
+		if (scheme == "unix")
+		{
+			return unix_socket(rest, SOCK_STREAM);
+		}
+		else if (scheme == "unix-seqpacket")
+		{
+			return unix_socket(rest, SOCK_SEQPACKET);
+		}
+		else if (scheme == "unix-abstract")
+		{
+			return abstract_unix_socket(rest, SOCK_STREAM);
+		}
+		else if (scheme == "unix-abstract-seqpacket")
+		{
+			return abstract_unix_socket(rest, SOCK_SEQPACKET);
+		}
+		else if (scheme == "tcp")
+		{
+			return tcp_socket(rest);
+		}
+		
+		throw std::runtime_error(std::string("invalid value of ") + std::string(global::env_name_socket)
+			+ ", expected one of unix:<path>, unix-seqpacket:<path>, unix-abstract:<name>, unix-abstract-seqpacket:<name>, tcp:<host>:<port>, value is: "
+			+ std::string(uri));
+	}
+	
+	static Transport from_env()
+	{
+		if (auto uri = std::getenv(global::env_name_socket.data()))
+		{
+			return parse(uri);
+		}
+		else if (auto unix_socket_path = std::getenv(global::env_name_unix_socket.data()))
+		{
+			return unix_socket(unix_socket_path, SOCK_STREAM);
+		}
+		else if (auto runtime_dir = std::getenv("XDG_RUNTIME_DIR"))
+		{
+			return unix_socket(std::string(runtime_dir) + "/" + std::string(global::default_unix_socket_name), SOCK_STREAM);
+		}
+		else
+		{
+			return unix_socket("/tmp/" + std::string(global::default_unix_socket_name), SOCK_STREAM);
+		}
+	}
+};
@@ -0,0 +1,18 @@
+target/object_files/main.o: src/main.cpp src/batch.hpp src/client.hpp \
+ src/bencode.hpp src/global.hpp src/probes.hpp src/session.hpp \
+ src/transport.hpp src/compression.hpp src/shared_memory.hpp \
+ src/stats.hpp src/hash.hpp src/trace.hpp src/io_uring.hpp src/cache.hpp
+src/batch.hpp:
+src/client.hpp:
+src/bencode.hpp:
+src/global.hpp:
+src/probes.hpp:
+src/session.hpp:
+src/transport.hpp:
+src/compression.hpp:
+src/shared_memory.hpp:
+src/stats.hpp:
+src/hash.hpp:
+src/trace.hpp:
+src/io_uring.hpp:
+src/cache.hpp:
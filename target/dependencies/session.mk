@@ -0,0 +1,10 @@
+target/object_files/session.o: src/session.cpp src/session.hpp \
+ src/bencode.hpp src/global.hpp src/transport.hpp src/compression.hpp \
+ src/hash.hpp src/probes.hpp
+src/session.hpp:
+src/bencode.hpp:
+src/global.hpp:
+src/transport.hpp:
+src/compression.hpp:
+src/hash.hpp:
+src/probes.hpp:
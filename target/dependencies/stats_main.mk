@@ -0,0 +1,5 @@
+target/object_files/stats_main.o: src/stats_main.cpp src/stats.hpp \
+ src/hash.hpp src/global.hpp
+src/stats.hpp:
+src/hash.hpp:
+src/global.hpp:
@@ -0,0 +1,357 @@
+#!/usr/bin/env python3
+
+import socket
+import os
+import re
+import struct
+import json
+import zlib
+import subprocess
+import sys
+import time
+from threading import Thread
+
+socket_name = "./target/benchmark.sock"
+client_binary = "./target/bin/daiyousei"
+
+def listen(transport = "unix"):
+	if transport == "tcp":
+		server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+		server.bind(("127.0.0.1", 0))
+		server.listen(True)
+		os.environ["DAIYOUSEI_SOCKET"] = "tcp:127.0.0.1:{}".format(server.getsockname()[1])
+		return server
+	os.environ.pop("DAIYOUSEI_SOCKET", None)
+	os.environ["DAIYOUSEI_UNIX_SOCKET"] = socket_name
+	try:
+		os.unlink(socket_name)
+	except:
+		pass
+	server = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+	server.bind((socket_name))
+	server.listen(True)
+	return server
+
+def drain(connection):
+	while len(connection.recv(65536)) != 0:
+		pass
+
+def statistics(stderr):
+	return {key.strip().decode(): int(value) for key, value in re.findall(rb"([a-z ]+): (\d+)", stderr.split(b"statistics:", 1)[-1])}
+
+def run(response, env = {}, stdout = subprocess.DEVNULL, transport = "unix"):
+	"""
+	Runs the client once against a server which sends the response as fast as possible
+	and returns the wall time and the statistics printed by the client.
+	"""
+	with listen(transport) as server:
+		start = time.monotonic()
+		with subprocess.Popen([client_binary],
+			stdin = subprocess.PIPE,
+			stdout = stdout,
+			stderr = subprocess.PIPE,
+			env = dict(os.environ, DAIYOUSEI_STATISTICS = "1", **env),
+		) as client:
+			client.stdin.close()
+			with server.accept()[0] as conn:
+				reader = Thread(target = drain, args = [conn])
+				reader.start()
+				conn.sendall(response)
+				stderr = client.stderr.read()
+				if client.wait() != 0:
+					raise RuntimeError(stderr.decode())
+				reader.join()
+		return time.monotonic() - start, statistics(stderr)
+
+def stdout_response(total_size, chunk_size):
+	chunk = b"6:stdout" + str(chunk_size).encode() + b":" + b"x" * chunk_size
+	return b"l" + chunk * (total_size // chunk_size) + b"8:exitcodei0ee"
+
+def frames_response(total_size, chunk_size):
+	chunk = struct.pack("<BI", 1, chunk_size) + b"x" * chunk_size
+	return b"l12:capabilitiesl6:framese" + chunk * (total_size // chunk_size) + b"8:exitcodei0ee"
+
+def benchmark_large_stdout():
+	response = stdout_response(64 * 1024 * 1024, 512 * 1024)
+	print("large stdout payload, 64 MiB in 512 KiB chunks")
+	print(f"{'max read size':>16} {'reads':>10} {'time [s]':>10}")
+	for max_read_size in [64 * 1024, 1024 * 1024]:
+		elapsed, stats = run(response, env = {"DAIYOUSEI_MAX_READ_SIZE": str(max_read_size)})
+		print(f"{max_read_size:>16} {stats['reads']:>10} {elapsed:>10.3f}")
+
+def benchmark_splice_stdout():
+	total_size = 256 * 1024 * 1024
+	response = stdout_response(total_size, 512 * 1024)
+	print("stdout throughput into a pipe, 256 MiB in 512 KiB chunks")
+	print(f"{'splice threshold':>16} {'MiB/s':>10} {'spliced':>10}")
+	for threshold in [None, 64 * 1024]:
+		env = {} if threshold is None else {"DAIYOUSEI_SPLICE_THRESHOLD": str(threshold)}
+		with subprocess.Popen(["cat"], stdin = subprocess.PIPE, stdout = subprocess.DEVNULL) as consumer:
+			elapsed, stats = run(response, env = env, stdout = consumer.stdin)
+			consumer.stdin.close()
+		print(f"{str(threshold):>16} {total_size / elapsed / 1024 / 1024:>10.0f} {stats['spliced bytes']:>10}")
+
+def benchmark_small_chunks():
+	total_size = 32 * 1024 * 1024
+	print("stdout in small chunks, 32 MiB in 256 B chunks")
+	print(f"{'encoding':>16} {'MiB/s':>10}")
+	for encoding, response in [("byte strings", stdout_response(total_size, 256)), ("frames", frames_response(total_size, 256))]:
+		elapsed, _ = run(response)
+		print(f"{encoding:>16} {total_size / elapsed / 1024 / 1024:>10.0f}")
+
+def log_text(size):
+	lines = []
+	total = 0
+	while total < size:
+		line = f"[{len(lines):>8}] INFO compiling src/module_{len(lines) % 97}.cpp with flags -O2 -g -Wall\n".encode()
+		lines.append(line)
+		total += len(line)
+	return b"".join(lines)[: size]
+
+def compressed_response(data, chunk_size):
+	compressor = zlib.compressobj(1, wbits = -15)
+	response = b"l12:capabilitiesl6:frames7:deflatee"
+	for i in range(0, len(data), chunk_size):
+		payload = compressor.compress(data[i : i + chunk_size]) + compressor.flush(zlib.Z_SYNC_FLUSH)
+		response += struct.pack("<BI", 0x81, len(payload)) + payload
+	return response + b"8:exitcodei0ee"
+
+def benchmark_compressed_stdout():
+	total_size = 64 * 1024 * 1024
+	data = log_text(total_size)
+	print("log-like stdout, 64 MiB in 64 KiB frames, compressed by the server in advance")
+	print(f"{'encoding':>16} {'wire MiB':>10} {'MiB/s':>10}")
+	plain = b"l12:capabilitiesl6:framese" + b"".join(struct.pack("<BI", 1, len(data[i : i + 65536])) + data[i : i + 65536]
+		for i in range(0, len(data), 65536)) + b"8:exitcodei0ee"
+	for encoding, response in [("frames", plain), ("deflate", compressed_response(data, 65536))]:
+		elapsed, _ = run(response)
+		print(f"{encoding:>16} {len(response) / 1024 / 1024:>10.1f} {total_size / elapsed / 1024 / 1024:>10.0f}")
+
+def benchmark_transports():
+	total_size = 64 * 1024 * 1024
+	data = log_text(total_size)
+	print("log-like stdout, 64 MiB in 64 KiB frames, per transport")
+	print(f"{'transport':>16} {'encoding':>10} {'MiB/s':>10}")
+	plain = b"l12:capabilitiesl6:framese" + b"".join(struct.pack("<BI", 1, len(data[i : i + 65536])) + data[i : i + 65536]
+		for i in range(0, len(data), 65536)) + b"8:exitcodei0ee"
+	for transport in ["unix", "tcp"]:
+		for encoding, response in [("frames", plain), ("deflate", compressed_response(data, 65536))]:
+			elapsed, _ = run(response, transport = transport)
+			print(f"{transport:>16} {encoding:>10} {total_size / elapsed / 1024 / 1024:>10.0f}")
+
+def benchmark_backends():
+	total_size = 64 * 1024 * 1024
+	response = stdout_response(total_size, 512 * 1024)
+	print("event loop backends, 200 invocations with an empty response and 64 MiB of stdout in 512 KiB chunks")
+	print(f"{'backend':>16} {'median [ms]':>12} {'MiB/s':>10}")
+	for backend, env in [("epoll", {}), ("io_uring", {"DAIYOUSEI_IO_URING": "1"})]:
+		latencies = sorted(run(b"l8:exitcodei0ee", env = env)[0] for i in range(200))
+		elapsed, _ = run(response, env = env)
+		print(f"{backend:>16} {latencies[len(latencies) // 2] * 1000:>12.2f} {total_size / elapsed / 1024 / 1024:>10.0f}")
+
+def value_end(data, pos = 0):
+	"""
+	@return The position following the bencode value starting at the position,
+	None if the value is incomplete
+	"""
+	if pos >= len(data):
+		return None
+	elif data[pos] in b"ld":
+		pos += 1
+		while pos is not None and pos < len(data) and data[pos] != ord("e"):
+			pos = value_end(data, pos)
+		return None if pos is None or pos >= len(data) else pos + 1
+	elif data[pos] == ord("i"):
+		end = data.find(b"e", pos)
+		return None if end == -1 else end + 1
+	colon = data.find(b":", pos)
+	if colon == -1:
+		return None
+	end = colon + 1 + int(data[pos : colon])
+	return end if end <= len(data) else None
+
+def serve_batch(server, count):
+	with server.accept()[0] as conn:
+		data = bytes()
+		for i in range(count):
+			while (end := value_end(data)) is None:
+				data += conn.recv(65536)
+			data = data[end:]
+			conn.sendall((b"l12:capabilitiesl5:batche" if i == 0 else b"l") + b"8:exitcodei0ee")
+
+def benchmark_batch():
+	count = 500
+	print(f"{count} commands with an empty response, one process each or one batch")
+	print(f"{'mode':>16} {'time [s]':>10} {'per command [ms]':>18}")
+	elapsed = sum(run(b"l8:exitcodei0ee")[0] for i in range(count))
+	print(f"{'processes':>16} {elapsed:>10.3f} {elapsed / count * 1000:>18.3f}")
+	with listen() as server:
+		serving = Thread(target = serve_batch, args = [server, count], daemon = True)
+		serving.start()
+		start = time.monotonic()
+		subprocess.run([client_binary], input = b"d4:argvl2:cc2:-cee" * count, stdout = subprocess.DEVNULL,
+			env = dict(os.environ, DAIYOUSEI_BATCH = "1"), check = True)
+		elapsed = time.monotonic() - start
+		serving.join()
+	print(f"{'batch':>16} {elapsed:>10.3f} {elapsed / count * 1000:>18.3f}")
+
+def benchmark_cache():
+	count = 50
+	cache_env = {"DAIYOUSEI_CACHE": "./target/benchmark-cache", "DAIYOUSEI_CACHE_COMMANDS": os.path.basename(client_binary)}
+	subprocess.run(["rm", "-rf", cache_env["DAIYOUSEI_CACHE"]], check = True)
+	print(f"{count} runs of a command with 4 MiB of stdout, served or replayed from the cache")
+	print(f"{'mode':>16} {'time [s]':>10} {'per run [ms]':>14}")
+	response = stdout_response(4 * 1024 * 1024, 512 * 1024)
+	elapsed = sum(run(response)[0] for i in range(count))
+	print(f"{'served':>16} {elapsed:>10.3f} {elapsed / count * 1000:>14.3f}")
+	run(response, env = cache_env)
+	start = time.monotonic()
+	for i in range(count):
+		subprocess.run([client_binary], stdin = subprocess.DEVNULL, stdout = subprocess.DEVNULL,
+			env = dict(os.environ, DAIYOUSEI_UNIX_SOCKET = "./target/nonexisting.sock", **cache_env), check = True)
+	elapsed = time.monotonic() - start
+	print(f"{'replayed':>16} {elapsed:>10.3f} {elapsed / count * 1000:>14.3f}")
+
+def serve_digests(server, count, acknowledgement):
+	"""
+	Serves requests which start with digests if the acknowledgement is not None
+	@return The total number of bytes received
+	"""
+	received = 0
+	for i in range(count):
+		with server.accept()[0] as conn:
+			data = bytes()
+			while acknowledgement is not None and ((end := value_end(data, 1)) is None or value_end(data, end) is None):
+				data += conn.recv(65536)
+			if acknowledgement is not None:
+				conn.sendall(acknowledgement)
+			while len(chunk := conn.recv(65536)) != 0:
+				data += chunk
+			received += len(data)
+			conn.sendall((b"" if acknowledgement is not None else b"l") + b"8:exitcodei0ee")
+	return received
+
+def benchmark_digests():
+	count = 200
+	argv = [client_binary] + [f"-I/usr/include/project/module-{i}" for i in range(200)] + ["-c", "file.c"]
+	env = dict(os.environ, **{f"VARIABLE_{i}": "x" * 1000 for i in range(100)})
+	print(f"{count} runs of a command with {len(argv)} arguments and {len(env)} environment variables")
+	print(f"{'mode':>16} {'time [s]':>10} {'per run [ms]':>14} {'bytes per run':>14}")
+	for mode, acknowledgement in [("whole", None), ("unknown", b"l7:digestsle"), ("known", b"l7:digestsl4:argv3:enve")]:
+		if acknowledgement is not None:
+			env.update(DAIYOUSEI_DIGESTS = "1000", DAIYOUSEI_ARGV_PREFIX = str(len(argv) - 2))
+		with listen() as server:
+			result = []
+			serving = Thread(target = lambda: result.append(serve_digests(server, count, acknowledgement)), daemon = True)
+			serving.start()
+			start = time.monotonic()
+			for i in range(count):
+				subprocess.run(argv, stdin = subprocess.DEVNULL, env = dict(env, DAIYOUSEI_UNIX_SOCKET = socket_name), check = True)
+			elapsed = time.monotonic() - start
+			serving.join()
+		print(f"{mode:>16} {elapsed:>10.3f} {elapsed / count * 1000:>14.3f} {result[0] // count:>14}")
+
+def startup_times(command, count, server = None, env = None):
+	"""
+	@return The median times in milliseconds from spawning the command until it connects,
+	if a server is given, and until it exits
+	"""
+	connect_times, exit_times = [], []
+	for i in range(count):
+		start = time.monotonic()
+		with subprocess.Popen(command, stdin = subprocess.DEVNULL, env = env) as process:
+			if server is not None:
+				with server.accept()[0] as conn:
+					connect_times.append(time.monotonic() - start)
+					conn.sendall(b"l8:exitcodei0ee")
+					drain(conn)
+			process.wait()
+			exit_times.append(time.monotonic() - start)
+	median = lambda times: sorted(times)[len(times) // 2] * 1000 if times else 0
+	return median(connect_times), median(exit_times)
+
+# Time a client with an empty response may take after exec in addition to a process doing nothing
+startup_budget_ms = 0.5
+
+def benchmark_startup():
+	count = 300
+	print(f"{count} runs with an empty response, median times after spawning, budget {startup_budget_ms} ms over /bin/true")
+	print(f"{'binary':>24} {'connect [ms]':>14} {'exit [ms]':>10} {'over true [ms]':>16}")
+	_, baseline = startup_times(["/bin/true"], count)
+	print(f"{'/bin/true':>24} {'':>14} {baseline:>10.3f}")
+	for binary in [client_binary, client_binary + "-minimal"]:
+		if os.path.exists(binary):
+			with listen() as server:
+				connect, exit = startup_times([binary], count, server)
+			verdict = "within budget" if exit - baseline <= startup_budget_ms else "over budget"
+			print(f"{os.path.basename(binary):>24} {connect:>14.3f} {exit:>10.3f} {exit - baseline:>16.3f} {verdict}")
+
+def benchmark_fast_exit():
+	count = 200
+	delay = 0.002
+	print(f"{count} runs of a server which ends the list {delay * 1000:.0f} ms after the exit code, median times after spawning")
+	print(f"{'mode':>16} {'exit [ms]':>10}")
+	for mode, env in [("default", {}), ("fast exit", {"DAIYOUSEI_FAST_EXIT": "1"})]:
+		times = []
+		with listen() as server:
+			for i in range(count):
+				start = time.monotonic()
+				with subprocess.Popen([client_binary], stdin = subprocess.DEVNULL, env = dict(os.environ, **env)) as client:
+					with server.accept()[0] as conn:
+						conn.sendall(b"l8:exitcodei0e")
+						try:
+							client.wait(timeout = delay)
+						except subprocess.TimeoutExpired:
+							conn.sendall(b"e")
+							client.wait()
+						times.append(time.monotonic() - start)
+		print(f"{mode:>16} {sorted(times)[len(times) // 2] * 1000:>10.3f}")
+
+def benchmark_trace():
+	count = 300
+	trace_name = "target/benchmark-trace.jsonl"
+	stats_name = "target/benchmark-stats"
+	print(f"{count} runs with an empty response, median times after spawning")
+	print(f"{'mode':>16} {'connect [ms]':>14} {'exit [ms]':>10}")
+	try:
+		for mode, env in [("disabled", {}), ("trace", {"DAIYOUSEI_TRACE": trace_name}), ("stats file", {"DAIYOUSEI_STATS_FILE": stats_name})]:
+			with listen() as server:
+				connect, exit = startup_times([client_binary], count, server, dict(os.environ, **env))
+			print(f"{mode:>16} {connect:>14.3f} {exit:>10.3f}")
+		with open(trace_name) as trace:
+			traces = [json.loads(line) for line in trace]
+		print("median phases of the traced runs relative to the start of the client:")
+		for name in ["connect_us", "request_sent_us", "first_byte_us", "exit_code_us", "end_of_list_us", "finished_us"]:
+			print(f"{name:>16} {sorted(trace[name] for trace in traces)[len(traces) // 2]:>10} us")
+		print("percentiles of the runs with the statistics file:")
+		subprocess.run([client_binary + "-stats", stats_name], check = True)
+	finally:
+		for name in [trace_name, stats_name]:
+			try:
+				os.unlink(name)
+			except FileNotFoundError:
+				pass
+
+benchmarks = {
+	"large-stdout": benchmark_large_stdout,
+	"splice-stdout": benchmark_splice_stdout,
+	"small-chunks": benchmark_small_chunks,
+	"compressed-stdout": benchmark_compressed_stdout,
+	"transports": benchmark_transports,
+	"backends": benchmark_backends,
+	"batch": benchmark_batch,
+	"cache": benchmark_cache,
+	"digests": benchmark_digests,
+	"startup": benchmark_startup,
+	"fast-exit": benchmark_fast_exit,
+	"trace": benchmark_trace,
+}
+
+try:
+	for name in sys.argv[1:] or benchmarks.keys():
+		benchmarks[name]()
+finally:
+	try:
+		os.unlink(socket_name)
+	except:
+		pass
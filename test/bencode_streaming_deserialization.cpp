@@ -84,6 +84,99 @@ Test_case("byte_string incomplete", []
 	Test_streaming_deserializer().test_incomplete("11:eoobarbazee");
 }),
 
+Test_case("byte_string skipped payload", []
+{
+	auto deserializer = Test_streaming_deserializer();
+	deserializer.receive("l3:foo10:abc");
+	testing::assert_eq(std::size_t(10), deserializer.pending_byte_string_length().value());
+	deserializer.skip_byte_string_payload(5);
+	testing::assert_eq(std::size_t(5), deserializer.pending_byte_string_length().value());
+	deserializer.receive("fghij3:bare");
+	testing::assert_eq("l3:foo5:fghij3:bare", deserializer);
+	testing::assert_true(deserializer.finished());
+}),
+
+Test_case("byte_string skipped whole payload", []
+{
+	auto deserializer = Test_streaming_deserializer();
+	deserializer.receive("l3:foo10:");
+	deserializer.skip_byte_string_payload(10);
+	deserializer.receive();
+	testing::assert_eq("l3:foo0:", deserializer);
+	deserializer.receive("e");
+	testing::assert_true(deserializer.finished());
+}),
+
+Test_case("foreign data", []
+{
+	struct Deserializer : Test_streaming_deserializer
+	{
+		/// A byte '#' followed by a one-digit payload length
+		std::size_t visit_foreign_data(std::string_view data) override
+		{
+			if (pending_foreign_data_length() != 0)
+			{
+				*this += "<" + std::string(data) + ">";
+				return data.size();
+			}
+			else if (data[0] != '#')
+			{
+				return Test_streaming_deserializer::visit_foreign_data(data);
+			}
+			else if (data.size() < 2)
+			{
+				return 0;
+			}
+			
+			claim_foreign_data(data[1] - '0');
+			return 2;
+		}
+	};
+	
+	auto deserializer = Deserializer();
+	deserializer.receive("l3:foo#");
+	deserializer.receive("5ie");
+	testing::assert_eq(std::size_t(3), deserializer.pending_foreign_data_length());
+	testing::assert_false(deserializer.finished());
+	deserializer.receive("3:##0i5ee");
+	testing::assert_eq("l3:foo<ie><3:#>i5ee", deserializer);
+	testing::assert_true(deserializer.finished());
+	
+	try
+	{
+		Deserializer().receive("l!");
+		fail_because("excpected an exception due to an unknown value type");
+	}
+	catch (bencode::Deserialization_exception& ex)
+	{
+	}
+}),
+
+Test_case("foreign data skipped", []
+{
+	struct Deserializer : Test_streaming_deserializer
+	{
+		std::size_t visit_foreign_data(std::string_view data) override
+		{
+			if (pending_foreign_data_length() != 0)
+			{
+				*this += "<" + std::string(data) + ">";
+				return data.size();
+			}
+			
+			claim_foreign_data(9);
+			return 1;
+		}
+	};
+	
+	auto deserializer = Deserializer();
+	deserializer.receive("l#abc");
+	deserializer.skip_foreign_data(3);
+	deserializer.receive("ghie");
+	testing::assert_eq("l<abc><ghi>e", deserializer);
+	testing::assert_true(deserializer.finished());
+}),
+
 Test_case("list", []
 {
 	Test_streaming_deserializer().test_whole("le");
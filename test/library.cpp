@@ -0,0 +1,392 @@
+#include <session.hpp>
+#include <testing.hpp>
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <thread>
+
+using Descriptor = std::experimental::unique_resource<int, void(*)(int)>;
+
+static void close_fd(int fd)
+{
+	close(fd);
+}
+
+static Descriptor checked(int fd, std::string_view description, std::source_location location = std::source_location::current())
+{
+	if (fd == -1)
+	{
+		testing::fail_because(std::string(description) + ": " + std::strerror(errno), location);
+	}
+	
+	return std::experimental::make_unique_resource_checked(fd, -1, &close_fd);
+}
+
+/// Collects a request, the response has its standard input as the standard output,
+/// its first argument as the standard error output and the number of arguments as the exit code,
+/// a request with the program name "invalid" receives an invalid response
+struct Echo_request : bencode::Streaming_deserializer
+{
+	std::vector<std::string> argv_;
+	std::string stdin_;
+	std::string key_;
+	int depth_ = 0;
+	bool complete_ = false;
+	
+	void visit_list_begin() override
+	{
+		++depth_;
+	}
+	
+	void visit_list_end() override
+	{
+		if (--depth_ == 0)
+		{
+			complete_ = true;
+		}
+		
+		key_.clear();
+	}
+	
+	void visit_byte_string(std::string_view value) override
+	{
+		if (depth_ == 2 and key_ == "argv")
+		{
+			argv_.emplace_back(value);
+		}
+		else if (depth_ == 1 and key_.empty())
+		{
+			key_ = value;
+		}
+		else if (depth_ == 1)
+		{
+			if (key_ == "stdin")
+			{
+				stdin_ += value;
+			}
+			
+			key_.clear();
+		}
+	}
+	
+	std::string response() const
+	{
+		auto result = bencode::Serializer::create();
+		result.push_raw_data("l");
+		
+		if (argv_.at(0) == "invalid")
+		{
+			result.push_raw_data("5:extrai1e");
+		}
+		else
+		{
+			for (auto output = std::string_view(stdin_); not output.empty(); output.remove_prefix(std::min(output.size(), global::max_byte_string_length)))
+			{
+				result.push_raw_data("6:stdout");
+				result.push_byte_string(output.substr(0, global::max_byte_string_length));
+			}
+			
+			result.push_raw_data("6:stderr");
+			result.push_byte_string(argv_.at(1));
+			result.push_raw_data("8:exitcode");
+			result.push_integer(argv_.size());
+		}
+		
+		result.push_raw_data("e");
+		return std::move(result.buffer_);
+	}
+};
+
+/// Serves the connections from a thread by a single epoll instance, like a server with many clients would
+struct Echo_server
+{
+	Descriptor listening_;
+	Descriptor stop_;
+	std::thread thread_;
+	
+	Echo_server(const Transport& transport, int backlog)
+		:
+		listening_(checked(socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0), "failed to create socket")),
+		stop_(checked(eventfd(0, EFD_CLOEXEC), "failed to create eventfd"))
+	{
+		unlink(transport.path_.c_str());
+		
+		if (bind(listening_.get(), reinterpret_cast<const sockaddr*>(&transport.address_), transport.address_length_) or listen(listening_.get(), backlog))
+		{
+			testing::fail_because(std::string("failed to listen: ") + std::strerror(errno));
+		}
+		
+		thread_ = std::thread(&Echo_server::serve, this);
+	}
+	
+	~Echo_server()
+	{
+		auto value = std::uint64_t(1);
+		[[maybe_unused]] auto written = write(stop_.get(), &value, sizeof(value));
+		thread_.join();
+	}
+	
+	static void send_all(int fd, std::string_view data)
+	{
+		while (not data.empty())
+		{
+			if (auto sent = send(fd, data.data(), data.size(), MSG_NOSIGNAL); sent != -1)
+			{
+				data.remove_prefix(sent);
+			}
+			else if (errno == EWOULDBLOCK or errno == EAGAIN)
+			{
+				auto descriptor = pollfd {.fd = fd, .events = POLLOUT, .revents = 0};
+				poll(&descriptor, 1, -1);
+			}
+			else
+			{
+				return;
+			}
+		}
+	}
+	
+	void serve()
+	{
+		auto epoll_fd = checked(epoll_create1(EPOLL_CLOEXEC), "failed to create epoll instance");
+		auto connections = std::map<int, std::pair<Descriptor, Echo_request>>();
+		
+		for (auto fd : {listening_.get(), stop_.get()})
+		{
+			auto event = epoll_event {.events = EPOLLIN, .data = {.fd = fd}};
+			epoll_ctl(epoll_fd.get(), EPOLL_CTL_ADD, fd, &event);
+		}
+		
+		auto events = std::array<epoll_event, 64>();
+		auto buffer = std::array<char, 64 * 1024>();
+		
+		while (true)
+		{
+			auto ready_events = epoll_wait(epoll_fd.get(), events.data(), int(events.size()), -1);
+			
+			for (int i = 0; i < ready_events; ++i)
+			{
+				auto fd = events[i].data.fd;
+				
+				if (fd == stop_.get())
+				{
+					return;
+				}
+				else if (fd == listening_.get())
+				{
+					for (int connection; (connection = accept4(listening_.get(), nullptr, nullptr, SOCK_CLOEXEC)) != -1;)
+					{
+						auto event = epoll_event {.events = EPOLLIN, .data = {.fd = connection}};
+						epoll_ctl(epoll_fd.get(), EPOLL_CTL_ADD, connection, &event);
+						connections.try_emplace(connection, std::experimental::make_unique_resource_checked(connection, -1, &close_fd), Echo_request());
+					}
+					
+					continue;
+				}
+				
+				auto& request = connections.at(fd).second;
+				auto read_bytes = recv(fd, buffer.data(), buffer.size(), 0);
+				
+				if (read_bytes > 0)
+				{
+					request.receive(std::string_view(buffer.data(), read_bytes));
+				}
+				
+				if (request.complete_)
+				{
+					send_all(fd, request.response());
+				}
+				
+				if (read_bytes <= 0 or request.complete_)
+				{
+					connections.erase(fd);
+				}
+			}
+		}
+	}
+};
+
+struct Test_session : daiyousei::Session
+{
+	std::string stdout_;
+	std::string stderr_;
+	std::string error_;
+	std::optional<int> received_exitcode_;
+	bool throw_on_exit_ = false;
+	
+	constexpr static auto environment = std::array {std::pair<std::string_view, std::string_view>("NAME", "value")};
+	
+	Test_session(const std::vector<std::string>& argv)
+		:
+		Session(daiyousei::Request {.argv_ = std::vector<std::string_view>(argv.begin(), argv.end()), .environment_ = environment, .cwd_ = "/"})
+	{
+	}
+	
+	void on_stdout(std::string_view data) override
+	{
+		stdout_ += data;
+	}
+	
+	void on_stderr(std::string_view data) override
+	{
+		stderr_ += data;
+	}
+	
+	void on_exit(int exitcode) override
+	{
+		received_exitcode_ = exitcode;
+		
+		if (throw_on_exit_)
+		{
+			throw std::runtime_error("thrown by on_exit");
+		}
+	}
+	
+	void on_error(std::string_view message) override
+	{
+		error_ = message;
+	}
+};
+
+static const auto transport = Transport::unix_socket("target/library.sock", SOCK_STREAM);
+
+std::initializer_list<testing::Test_case> testing::test_cases
+{
+Test_case("thousands of concurrent sessions", []
+{
+	// each session holds a descriptor on both sides of the connection
+	auto limit = rlimit();
+	getrlimit(RLIMIT_NOFILE, &limit);
+	limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, 8192);
+	setrlimit(RLIMIT_NOFILE, &limit);
+	auto count = std::min<std::size_t>(2000, (limit.rlim_cur - 64) / 2);
+	
+	// the small backlog makes the sessions retry connecting
+	auto server = Echo_server(transport, 16);
+	auto loop = daiyousei::Event_loop(transport);
+	auto sessions = std::deque<Test_session>();
+	
+	for (std::size_t i = 0; i != count; ++i)
+	{
+		auto& session = sessions.emplace_back(std::vector<std::string> {"echo", "session " + std::to_string(i)});
+		session.write_stdin("input " + std::to_string(i));
+		session.close_stdin();
+		loop.start(session);
+	}
+	
+	testing::assert_eq(count, loop.active());
+	loop.run();
+	testing::assert_eq(std::size_t(0), loop.active());
+	
+	for (std::size_t i = 0; i != count; ++i)
+	{
+		testing::assert_eq(std::string(), sessions[i].error_);
+		testing::assert_true(sessions[i].done());
+		testing::assert_eq(2, sessions[i].received_exitcode_.value());
+		testing::assert_eq("input " + std::to_string(i), sessions[i].stdout_);
+		testing::assert_eq("session " + std::to_string(i), sessions[i].stderr_);
+	}
+}),
+
+Test_case("standard input written while running", []
+{
+	auto server = Echo_server(transport, 16);
+	auto loop = daiyousei::Event_loop(transport);
+	auto session = Test_session({"echo", "large"});
+	loop.start(session);
+	
+	// longer than a single byte string of the standard input
+	auto input = std::string(1'500'000, 'x');
+	loop.run_once(std::chrono::milliseconds(0));
+	session.write_stdin(std::string_view(input).substr(0, 1000));
+	loop.run_once(std::chrono::milliseconds(0));
+	session.write_stdin(std::string_view(input).substr(1000));
+	session.close_stdin();
+	loop.run();
+	
+	testing::assert_eq(std::string(), session.error_);
+	testing::assert_eq(2, session.received_exitcode_.value());
+	testing::assert_true(input == session.stdout_);
+}),
+
+Test_case("nonexisting socket", []
+{
+	unlink(transport.path_.c_str());
+	auto loop = daiyousei::Event_loop(transport);
+	auto session = Test_session({"echo", "nothing"});
+	loop.start(session);
+	
+	testing::assert_true(session.done());
+	testing::assert_eq(std::size_t(0), loop.active());
+	testing::assert_true(session.error_.contains("No such file or directory"));
+}),
+
+Test_case("invalid response", []
+{
+	auto server = Echo_server(transport, 16);
+	auto loop = daiyousei::Event_loop(transport);
+	auto valid = Test_session({"echo", "valid"});
+	auto invalid = Test_session({"invalid", "invalid"});
+	
+	for (auto* session : {&valid, &invalid})
+	{
+		session->close_stdin();
+		loop.start(*session);
+	}
+	
+	loop.run();
+	
+	testing::assert_true(invalid.error_.contains("key 'extra' is not valid"));
+	testing::assert_false(invalid.received_exitcode_.has_value());
+	testing::assert_eq(2, valid.received_exitcode_.value());
+}),
+
+Test_case("exception thrown by on_exit", []
+{
+	auto server = Echo_server(transport, 16);
+	auto loop = daiyousei::Event_loop(transport);
+	auto session = Test_session({"echo", "throwing"});
+	session.throw_on_exit_ = true;
+	session.close_stdin();
+	loop.start(session);
+	
+	try
+	{
+		loop.run();
+		testing::fail_because("the exception of on_exit was not propagated");
+	}
+	catch (std::runtime_error& ex)
+	{
+		testing::assert_eq(std::string_view("thrown by on_exit"), std::string_view(ex.what()));
+	}
+	
+	// the session is released only once and does not fail after it has exited
+	testing::assert_eq(std::size_t(0), loop.active());
+	testing::assert_true(session.error_.empty());
+	testing::assert_eq(2, session.received_exitcode_.value());
+}),
+
+Test_case("session destroyed before it is done", []
+{
+	auto server = Echo_server(transport, 16);
+	auto loop = daiyousei::Event_loop(transport);
+	
+	{
+		auto session = Test_session({"echo", "abandoned"});
+		loop.start(session);
+		testing::assert_eq(std::size_t(1), loop.active());
+	}
+	
+	testing::assert_eq(std::size_t(0), loop.active());
+	loop.run();
+}),
+};
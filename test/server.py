@@ -4,6 +4,14 @@ import socket
 import sys 
 import time
 import os
+import re
+import mmap
+import select
+import shutil
+import struct
+import json
+import fcntl
+import zlib
 import subprocess
 from threading import Thread
 
@@ -30,6 +38,67 @@ def setup():
 	server.listen(True)
 	return server
 
+def decode(data, pos = 0):
+	if data[pos] == ord("i"):
+		end = data.index(b"e", pos)
+		return int(data[pos + 1 : end]), end + 1
+	elif data[pos] == ord("l"):
+		result = []
+		pos += 1
+		while data[pos] != ord("e"):
+			value, pos = decode(data, pos)
+			result.append(value)
+		return result, pos + 1
+	elif data[pos] == ord("d"):
+		result = {}
+		pos += 1
+		while data[pos] != ord("e"):
+			key, pos = decode(data, pos)
+			result[key], pos = decode(data, pos)
+		return result, pos + 1
+	else:
+		colon = data.index(b":", pos)
+		end = colon + 1 + int(data[pos : colon])
+		return data[colon + 1 : end], end
+
+def receive_request(connection, data):
+	"""
+	Receives one whole request from a connection which may carry more of them,
+	@return The request and the data following it
+	"""
+	while True:
+		try:
+			request, end = decode(data)
+			return request, data[end:]
+		except (IndexError, ValueError):
+			chunk = connection.recv(65536)
+			if len(chunk) == 0:
+				raise EOFError("connection closed")
+			data += chunk
+
+def receive_all(connection):
+	data = bytes()
+	while True:
+		chunk = connection.recv(65536)
+		if len(chunk) == 0:
+			return data
+		data += chunk
+
+def stdin_of(request):
+	request, _ = decode(request)
+	return b"".join(request[i + 1] for i in range(6, len(request), 2) if request[i] == b"stdin")
+
+def receive_fds(connection, suffix):
+	data = bytes()
+	received = []
+	while not data.endswith(suffix):
+		message, fds, _, _ = socket.recv_fds(connection, 65536, 8)
+		if len(message) == 0:
+			raise EOFError("connection closed")
+		data += message
+		received += fds
+	return data, received
+
 def run_client(stdin = subprocess.PIPE, stdout = subprocess.PIPE, stderr = subprocess.PIPE):
 	return subprocess.Popen(["./target/bin/daiyousei"],
 		stdin = stdin,
@@ -124,6 +193,18 @@ class Test_Simple(unittest.TestCase):
 			self.assertEqual(b"some error", stderr)
 			self.assertEqual(0, client.wait())
 	
+	def test_small_max_read_size(self):
+		os.environ["DAIYOUSEI_MAX_READ_SIZE"] = "1"
+		try:
+			with setup() as server, run_client() as client, server.accept()[0] as conn:
+				while len(consume(conn)) == 0:
+					pass
+				conn.send(b"l6:stdout11:some output8:exitcodei0ee")
+				self.assertEqual(b"some output", client.stdout.read())
+				self.assertEqual(0, client.wait())
+		finally:
+			del os.environ["DAIYOUSEI_MAX_READ_SIZE"]
+	
 	def test_multiple_exit_codes(self):
 		with setup() as server, run_client() as client, server.accept()[0] as conn:
 			while len(consume(conn)) == 0:
@@ -220,6 +301,1404 @@ class Test_Simple(unittest.TestCase):
 			conn.close()
 			self.assertEqual(255, client.wait())
 
+class Test_Stdin_types(unittest.TestCase):
+	def test_regular_file(self):
+		data = os.urandom(3 * 1024 * 1024 + 7)
+		with open("./target/stdin.bin", "wb") as file:
+			file.write(data)
+		try:
+			with open("./target/stdin.bin", "rb") as file, setup() as server, run_client(stdin = file) as client, server.accept()[0] as conn:
+				request = receive_all(conn)
+				conn.send(b"l8:exitcodei0ee")
+				self.assertEqual(0, client.wait())
+				self.assertEqual(data, stdin_of(request))
+		finally:
+			os.unlink("./target/stdin.bin")
+	
+	def test_empty_regular_file(self):
+		with open("./target/stdin.bin", "wb") as file:
+			pass
+		try:
+			with open("./target/stdin.bin", "rb") as file, setup() as server, run_client(stdin = file) as client, server.accept()[0] as conn:
+				request = receive_all(conn)
+				conn.send(b"l8:exitcodei0ee")
+				self.assertEqual(0, client.wait())
+				self.assertEqual(b"", stdin_of(request))
+		finally:
+			os.unlink("./target/stdin.bin")
+	
+	def test_dev_null(self):
+		with setup() as server, run_client(stdin = subprocess.DEVNULL) as client, server.accept()[0] as conn:
+			request = receive_all(conn)
+			conn.send(b"l8:exitcodei0ee")
+			self.assertEqual(0, client.wait())
+			self.assertEqual(b"", stdin_of(request))
+
+class Test_Coalescing(unittest.TestCase):
+	def test_coalesced_stdout(self):
+		os.environ["DAIYOUSEI_STATISTICS"] = "1"
+		try:
+			with setup() as server, run_client() as client, server.accept()[0] as conn:
+				while len(consume(conn)) == 0:
+					pass
+				conn.send(b"l" + b"6:stdout3:abc" * 100 + b"8:exitcodei0ee")
+				self.assertEqual(b"abc" * 100, client.stdout.read())
+				self.assertEqual(0, client.wait())
+				stderr = client.stderr.read()
+				self.assertTrue(b"output chunks: 100," in stderr)
+				self.assertLess(0, int(re.search(rb"writes saved: (\d+)", stderr)[1]))
+		finally:
+			del os.environ["DAIYOUSEI_STATISTICS"]
+	
+	def test_interleaved_outputs_same_file(self):
+		with setup() as server, run_client(stderr = subprocess.STDOUT) as client, server.accept()[0] as conn:
+			while len(consume(conn)) == 0:
+				pass
+			conn.send(b"l6:stdout1:a6:stderr1:b6:stdout1:c6:stderr1:d8:exitcodei0ee")
+			self.assertEqual(b"abcd", client.stdout.read())
+			self.assertEqual(0, client.wait())
+
+class Test_Splice(unittest.TestCase):
+	def setUp(self):
+		os.environ["DAIYOUSEI_SPLICE_THRESHOLD"] = "1000"
+		os.environ["DAIYOUSEI_STATISTICS"] = "1"
+		self.data = os.urandom(2 * 500000)
+		self.response = b"l6:stdout2:ab6:stderr1:x6:stdout500000:" + self.data[: 500000] + b"6:stdout500000:" + self.data[500000 :] + b"6:stdout2:cd8:exitcodei0ee"
+	
+	def tearDown(self):
+		del os.environ["DAIYOUSEI_SPLICE_THRESHOLD"]
+		del os.environ["DAIYOUSEI_STATISTICS"]
+	
+	def serve(self, conn):
+		while len(consume(conn)) == 0:
+			pass
+		for i in range(0, len(self.response), 70000):
+			conn.sendall(self.response[i : i + 70000])
+	
+	def test_splice_pipe(self):
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			sender = Thread(target = self.serve, args = [conn])
+			sender.start()
+			self.assertEqual(b"ab" + self.data + b"cd", client.stdout.read())
+			sender.join()
+			self.assertEqual(0, client.wait())
+			stderr = client.stderr.read()
+			self.assertTrue(stderr.startswith(b"x"))
+			self.assertLess(0, int(re.search(rb"spliced bytes: (\d+)", stderr)[1]))
+	
+	def test_splice_file(self):
+		try:
+			with open("./target/stdout.bin", "wb") as stdout, setup() as server, run_client(stdout = stdout) as client, server.accept()[0] as conn:
+				self.serve(conn)
+				self.assertEqual(0, client.wait())
+				self.assertLess(0, int(re.search(rb"spliced bytes: (\d+)", client.stderr.read())[1]))
+			with open("./target/stdout.bin", "rb") as stdout:
+				self.assertEqual(b"ab" + self.data + b"cd", stdout.read())
+		finally:
+			os.unlink("./target/stdout.bin")
+	
+	def test_fallback_append(self):
+		try:
+			with open("./target/stdout.bin", "ab") as stdout, setup() as server, run_client(stdout = stdout) as client, server.accept()[0] as conn:
+				self.serve(conn)
+				self.assertEqual(0, client.wait())
+				self.assertEqual(0, int(re.search(rb"spliced bytes: (\d+)", client.stderr.read())[1]))
+			with open("./target/stdout.bin", "rb") as stdout:
+				self.assertEqual(b"ab" + self.data + b"cd", stdout.read())
+		finally:
+			os.unlink("./target/stdout.bin")
+
+def frame(fd, data):
+	return bytes([fd]) + struct.pack("<I", len(data)) + data
+
+class Test_Capabilities(unittest.TestCase):
+	def test_offered(self):
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			client.stdin.close()
+			request, _ = decode(receive_all(conn))
+			conn.send(b"l8:exitcodei0ee")
+			self.assertEqual(0, client.wait())
+			self.assertEqual(b"capabilities", request[6])
+			self.assertIn(b"frames", request[7])
+	
+	def test_disabled(self):
+		os.environ["DAIYOUSEI_CAPABILITIES"] = ""
+		try:
+			with setup() as server, run_client() as client, server.accept()[0] as conn:
+				client.stdin.close()
+				request, _ = decode(receive_all(conn))
+				conn.send(b"l8:exitcodei0ee")
+				self.assertEqual(0, client.wait())
+				self.assertEqual(6, len(request))
+		finally:
+			del os.environ["DAIYOUSEI_CAPABILITIES"]
+	
+	def test_frames(self):
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			while len(consume(conn)) == 0:
+				pass
+			conn.send(b"l12:capabilitiesl6:framese" + frame(1, b"ready"))
+			self.assertEqual(b"ready", client.stdout.read(5))
+			client.stdin.write(b"input")
+			client.stdin.close()
+			self.assertEqual(frame(0, b"input") + b"e", receive_all(conn))
+			conn.send(frame(2, b"error") + frame(1, b"") + frame(1, b"output") + b"8:exitcodei3e" + frame(2, b"!") + b"e")
+			self.assertEqual(b"output", client.stdout.read())
+			self.assertEqual(b"error!", client.stderr.read())
+			self.assertEqual(3, client.wait())
+	
+	def test_frames_splice(self):
+		data = os.urandom(1024 * 1024)
+		response = b"l12:capabilitiesl6:framese" + frame(1, b"ab") + frame(1, data) + frame(1, b"cd") + b"8:exitcodei0ee"
+		os.environ["DAIYOUSEI_SPLICE_THRESHOLD"] = "1000"
+		os.environ["DAIYOUSEI_STATISTICS"] = "1"
+		try:
+			with setup() as server, run_client() as client, server.accept()[0] as conn:
+				def serve():
+					for i in range(0, len(response), 70000):
+						conn.sendall(response[i : i + 70000])
+				sender = Thread(target = serve)
+				sender.start()
+				self.assertEqual(b"ab" + data + b"cd", client.stdout.read())
+				sender.join()
+				self.assertEqual(0, client.wait())
+				self.assertLess(0, int(re.search(rb"spliced bytes: (\d+)", client.stderr.read())[1]))
+		finally:
+			del os.environ["DAIYOUSEI_SPLICE_THRESHOLD"]
+			del os.environ["DAIYOUSEI_STATISTICS"]
+	
+	def test_not_offered(self):
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			conn.send(b"l12:capabilitiesl7:unknowne8:exitcodei0ee")
+			self.assertEqual(255, client.wait())
+	
+	def test_frames_not_acknowledged(self):
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			conn.send(b"l" + frame(1, b"output") + b"8:exitcodei0ee")
+			self.assertEqual(255, client.wait())
+
+class Test_Compression(unittest.TestCase):
+	def setUp(self):
+		self.compressor = zlib.compressobj(wbits = -15)
+	
+	def compressed_frame(self, fd, data):
+		payload = self.compressor.compress(data) + self.compressor.flush(zlib.Z_SYNC_FLUSH)
+		return bytes([0x80 | fd]) + struct.pack("<I", len(payload)) + payload
+	
+	def test_compressed_outputs(self):
+		data = b"compressible text\n" * 100000
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			def serve():
+				conn.sendall(b"l12:capabilitiesl6:frames7:deflatee" + self.compressed_frame(1, data) + self.compressed_frame(2, b"error")
+					+ frame(1, b"plain") + self.compressed_frame(1, b"") + self.compressed_frame(1, data) + b"8:exitcodei0ee")
+			sender = Thread(target = serve)
+			sender.start()
+			self.assertEqual(data + b"plain" + data, client.stdout.read())
+			sender.join()
+			self.assertEqual(b"error", client.stderr.read())
+			self.assertEqual(0, client.wait())
+	
+	def test_compressed_stdin(self):
+		data = b"compressible text\n" * 100000
+		os.environ["DAIYOUSEI_COMPRESSION_THRESHOLD"] = "1000"
+		try:
+			with setup() as server, run_client() as client, server.accept()[0] as conn:
+				while len(consume(conn)) == 0:
+					pass
+				conn.send(b"l12:capabilitiesl6:frames7:deflatee" + frame(1, b"ready"))
+				self.assertEqual(b"ready", client.stdout.read(5))
+				def produce():
+					client.stdin.write(data)
+					client.stdin.close()
+				producer = Thread(target = produce)
+				producer.start()
+				request = receive_all(conn)
+				producer.join()
+				conn.send(b"8:exitcodei0ee")
+				self.assertEqual(0, client.wait())
+				decompressor = zlib.decompressobj(wbits = -15)
+				received = bytes()
+				compressed = 0
+				while request != b"e":
+					length = struct.unpack_from("<I", request, 1)[0]
+					payload = request[5 : 5 + length]
+					if request[0] == 0x80:
+						payload = decompressor.decompress(payload)
+						compressed += 1
+					else:
+						self.assertEqual(0, request[0])
+						self.assertLess(len(payload), 1000)
+					received += payload
+					request = request[5 + length :]
+				self.assertEqual(data, received)
+				self.assertLess(0, compressed)
+		finally:
+			del os.environ["DAIYOUSEI_COMPRESSION_THRESHOLD"]
+	
+	def test_deflate_without_frames(self):
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			conn.send(b"l12:capabilitiesl7:deflatee8:exitcodei0ee")
+			self.assertEqual(255, client.wait())
+
+class Test_Stdin_coalescing(unittest.TestCase):
+	def setUp(self):
+		os.environ["DAIYOUSEI_STDIN_COALESCE"] = "16:300000"
+	
+	def tearDown(self):
+		del os.environ["DAIYOUSEI_STDIN_COALESCE"]
+	
+	def test_coalesced_by_delay(self):
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			while len(consume(conn)) == 0:
+				pass
+			client.stdin.write(b"line 1\n")
+			client.stdin.flush()
+			client.stdin.write(b"line 2\n")
+			client.stdin.flush()
+			expected_string = b"5:stdin14:line 1\nline 2\n"
+			self.assertEqual(expected_string, conn.recv(len(expected_string), socket.MSG_WAITALL))
+			conn.send(b"l8:exitcodei0ee")
+			self.assertEqual(0, client.wait())
+	
+	def test_coalesced_by_size(self):
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			while len(consume(conn)) == 0:
+				pass
+			start = time.monotonic()
+			client.stdin.write(b"some input")
+			client.stdin.flush()
+			client.stdin.write(b"more input")
+			client.stdin.flush()
+			expected_string = b"5:stdin20:some inputmore input"
+			self.assertEqual(expected_string, conn.recv(len(expected_string), socket.MSG_WAITALL))
+			self.assertLess(time.monotonic() - start, 0.3)
+			conn.send(b"l8:exitcodei0ee")
+			self.assertEqual(0, client.wait())
+	
+	def test_invalid_value(self):
+		os.environ["DAIYOUSEI_STDIN_COALESCE"] = "16"
+		with setup() as server, run_client() as client:
+			self.assertEqual(255, client.wait())
+			self.assertTrue(b"DAIYOUSEI_STDIN_COALESCE" in client.stderr.read())
+	
+	def test_size_above_byte_string_limit(self):
+		os.environ["DAIYOUSEI_STDIN_COALESCE"] = "1000000:1000"
+		with setup() as server, run_client() as client:
+			self.assertEqual(255, client.wait())
+			self.assertTrue(b"DAIYOUSEI_STDIN_COALESCE" in client.stderr.read())
+	
+	def test_large_reads_split(self):
+		os.environ["DAIYOUSEI_STDIN_COALESCE"] = "999999:2000000"
+		os.environ["DAIYOUSEI_MAX_READ_SIZE"] = "4000000"
+		data = os.urandom(3 * 1024 * 1024)
+		try:
+			with setup() as server, run_client() as client, server.accept()[0] as conn:
+				def produce():
+					client.stdin.write(data)
+					client.stdin.close()
+				producer = Thread(target = produce)
+				producer.start()
+				request = receive_all(conn)
+				producer.join()
+				conn.send(b"l8:exitcodei0ee")
+				self.assertEqual(0, client.wait())
+				decoded, _ = decode(request)
+				chunks = [decoded[i + 1] for i in range(6, len(decoded), 2) if decoded[i] == b"stdin"]
+				self.assertTrue(all(len(chunk) <= 999999 for chunk in chunks))
+				self.assertEqual(data, b"".join(chunks))
+		finally:
+			del os.environ["DAIYOUSEI_MAX_READ_SIZE"]
+
+class Test_Backpressure(unittest.TestCase):
+	def test_large_stdin_slow_server(self):
+		data = os.urandom(8 * 1024 * 1024)
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			def produce():
+				client.stdin.write(data)
+				client.stdin.close()
+			producer = Thread(target = produce)
+			producer.start()
+			time.sleep(0.5)
+			request = receive_all(conn)
+			producer.join()
+			conn.send(b"l8:exitcodei0ee")
+			self.assertEqual(0, client.wait())
+			self.assertEqual(data, stdin_of(request))
+	
+	def test_stdin_while_stdout_blocked(self):
+		data = os.urandom(4 * 1024 * 1024)
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			while len(consume(conn)) == 0:
+				pass
+			def produce():
+				conn.sendall(b"l")
+				for i in range(0, len(data), 65536):
+					conn.sendall(b"6:stdout65536:" + data[i : i + 65536])
+			producer = Thread(target = produce)
+			producer.start()
+			time.sleep(0.5)
+			client.stdin.write(b"some input")
+			client.stdin.flush()
+			expected_string = b"5:stdin10:some input"
+			self.assertEqual(expected_string, conn.recv(len(expected_string)))
+			stdout = bytes()
+			def read_stdout():
+				nonlocal stdout
+				stdout = client.stdout.read()
+			reader = Thread(target = read_stdout)
+			reader.start()
+			producer.join()
+			conn.send(b"8:exitcodei0ee")
+			reader.join()
+			self.assertEqual(0, client.wait())
+			self.assertEqual(data, stdout)
+
+class Test_Fd_passing(unittest.TestCase):
+	def setUp(self):
+		os.environ["DAIYOUSEI_PASS_FDS"] = "2000"
+	
+	def tearDown(self):
+		del os.environ["DAIYOUSEI_PASS_FDS"]
+	
+	def receive_fds(self, conn):
+		_, received = receive_fds(conn, b"3:fdsl5:stdin6:stdout6:stderr3:cwde")
+		self.assertEqual(4, len(received))
+		return received
+	
+	def test_accepted(self):
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			stdin, stdout, stderr, cwd = self.receive_fds(conn)
+			try:
+				self.assertEqual(os.getcwd(), os.readlink("/proc/self/fd/{}".format(cwd)))
+				conn.send(b"l3:fdsi1e")
+				client.stdin.write(b"input")
+				client.stdin.close()
+				self.assertEqual(b"input", os.read(stdin, 5))
+				os.write(stdout, b"output")
+				os.write(stderr, b"error")
+			finally:
+				for fd in [stdin, stdout, stderr, cwd]:
+					os.close(fd)
+			self.assertEqual(b"e", receive_all(conn))
+			conn.send(b"8:exitcodei3ee")
+			self.assertEqual(b"output", client.stdout.read())
+			self.assertEqual(b"error", client.stderr.read())
+			self.assertEqual(3, client.wait())
+	
+	def test_rejected(self):
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			for fd in self.receive_fds(conn):
+				os.close(fd)
+			conn.send(b"l3:fdsi0e")
+			client.stdin.write(b"input")
+			client.stdin.close()
+			request = receive_all(conn)
+			conn.send(b"6:stdout6:output8:exitcodei0ee")
+			self.assertEqual(b"5:stdin5:inpute", request)
+			self.assertEqual(b"output", client.stdout.read())
+			self.assertEqual(0, client.wait())
+	
+	def test_old_server(self):
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			for fd in self.receive_fds(conn):
+				os.close(fd)
+			conn.send(b"l6:stdout6:output")
+			client.stdin.write(b"input")
+			client.stdin.close()
+			request = receive_all(conn)
+			conn.send(b"8:exitcodei0ee")
+			self.assertEqual(b"5:stdin5:inpute", request)
+			self.assertEqual(b"output", client.stdout.read())
+			self.assertEqual(0, client.wait())
+	
+	def test_timeout(self):
+		os.environ["DAIYOUSEI_PASS_FDS"] = "100"
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			for fd in self.receive_fds(conn):
+				os.close(fd)
+			client.stdin.write(b"input")
+			client.stdin.close()
+			request = receive_all(conn)
+			conn.send(b"l8:exitcodei0ee")
+			self.assertEqual(b"5:stdin5:inpute", request)
+			self.assertEqual(0, client.wait())
+
+class Shared_rings:
+	def __init__(self, fds, size):
+		file, self.client_event, self.server_event = fds
+		self.size = size
+		self.memory = mmap.mmap(file, 4096 + 2 * size)
+		os.close(file)
+	
+	def close(self):
+		self.memory.close()
+		os.close(self.client_event)
+		os.close(self.server_event)
+	
+	def load(self, offset):
+		return struct.unpack_from("=Q", self.memory, offset)[0]
+	
+	def store(self, offset, value):
+		struct.pack_into("=Q", self.memory, offset, value)
+	
+	def wait(self):
+		struct.pack_into("=I", self.memory, 320, 1)
+		if len(select.select([self.server_event], [], [], 0.01)[0]) != 0:
+			os.eventfd_read(self.server_event)
+	
+	def wake_client(self):
+		# always woken up, the test does not need to avoid system calls
+		struct.pack_into("=I", self.memory, 256, 0)
+		os.eventfd_write(self.client_event, 1)
+	
+	def read_stdin(self):
+		head = self.load(0)
+		tail = self.load(64)
+		data = self.copy(4096, tail, head - tail)
+		self.store(64, head)
+		self.wake_client()
+		return data
+	
+	def copy(self, base, position, length):
+		position %= self.size
+		first = min(length, self.size - position)
+		return self.memory[base + position : base + position + first] + self.memory[base : base + length - first]
+	
+	def write_output(self, fd, data):
+		data = struct.pack("=II", fd, len(data)) + data
+		while len(data) != 0:
+			head = self.load(128)
+			length = min(len(data), self.size - (head - self.load(192)))
+			if length == 0:
+				self.wait()
+				continue
+			position = head % self.size
+			first = min(length, self.size - position)
+			base = 4096 + self.size
+			self.memory[base + position : base + position + first] = data[: first]
+			self.memory[base : base + length - first] = data[first : length]
+			self.store(128, head + length)
+			self.wake_client()
+			data = data[length :]
+
+class Test_Shared_memory(unittest.TestCase):
+	def setUp(self):
+		os.environ["DAIYOUSEI_SHARED_MEMORY"] = "4096:2000"
+	
+	def tearDown(self):
+		del os.environ["DAIYOUSEI_SHARED_MEMORY"]
+	
+	def accept(self, conn):
+		_, fds = receive_fds(conn, b"3:shmi4096e")
+		self.assertEqual(3, len(fds))
+		conn.send(b"l3:shmi1e")
+		return Shared_rings(fds, 4096)
+	
+	def test_accepted(self):
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			rings = self.accept(conn)
+			try:
+				client.stdin.write(b"input")
+				client.stdin.close()
+				self.assertEqual(b"e", receive_all(conn))
+				self.assertEqual(b"input", rings.read_stdin())
+				rings.write_output(1, b"output")
+				rings.write_output(2, b"error")
+				conn.send(b"8:exitcodei3ee")
+				self.assertEqual(b"output", client.stdout.read())
+				self.assertEqual(b"error", client.stderr.read())
+				self.assertEqual(3, client.wait())
+			finally:
+				rings.close()
+	
+	def test_wrapping(self):
+		stdin = os.urandom(1024 * 1024)
+		stdout = os.urandom(1024 * 1024)
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			rings = self.accept(conn)
+			try:
+				def produce():
+					client.stdin.write(stdin)
+					client.stdin.close()
+				producer = Thread(target = produce)
+				producer.start()
+				conn.setblocking(False)
+				request = bytes()
+				received = bytes()
+				while request != b"e" or len(received) != len(stdin):
+					received += rings.read_stdin()
+					try:
+						request += conn.recv(1)
+					except BlockingIOError:
+						rings.wait()
+				conn.setblocking(True)
+				producer.join()
+				self.assertEqual(stdin, received)
+				result = bytes()
+				def read_stdout():
+					nonlocal result
+					result = client.stdout.read()
+				reader = Thread(target = read_stdout)
+				reader.start()
+				for i in range(0, len(stdout), 10000):
+					rings.write_output(1, stdout[i : i + 10000])
+				conn.send(b"8:exitcodei0ee")
+				reader.join()
+				self.assertEqual(0, client.wait())
+				self.assertEqual(stdout, result)
+			finally:
+				rings.close()
+	
+	def test_rejected(self):
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			for fd in receive_fds(conn, b"3:shmi4096e")[1]:
+				os.close(fd)
+			conn.send(b"l3:shmi0e")
+			client.stdin.write(b"input")
+			client.stdin.close()
+			request = receive_all(conn)
+			conn.send(b"6:stdout6:output8:exitcodei0ee")
+			self.assertEqual(b"5:stdin5:inpute", request)
+			self.assertEqual(b"output", client.stdout.read())
+			self.assertEqual(0, client.wait())
+
+class Test_Io_uring(unittest.TestCase):
+	def setUp(self):
+		os.environ["DAIYOUSEI_IO_URING"] = "1"
+	
+	def tearDown(self):
+		del os.environ["DAIYOUSEI_IO_URING"]
+	
+	def uring_enabled(self):
+		try:
+			with open("/proc/sys/kernel/io_uring_disabled") as disabled:
+				return disabled.read().strip() == "0"
+		except FileNotFoundError:
+			return True
+	
+	def test_backend(self):
+		os.environ["DAIYOUSEI_STATISTICS"] = "1"
+		try:
+			with setup() as server, run_client() as client, server.accept()[0] as conn:
+				while len(consume(conn)) == 0:
+					pass
+				conn.send(b"l6:stdout3:abc8:exitcodei0ee")
+				self.assertEqual(b"abc", client.stdout.read())
+				self.assertEqual(0, client.wait())
+				backend = re.search(rb"backend: (\w+)", client.stderr.read())[1]
+				self.assertEqual(b"io_uring" if self.uring_enabled() else b"epoll", backend)
+		finally:
+			del os.environ["DAIYOUSEI_STATISTICS"]
+	
+	def test_nonexisting_socket(self):
+		os.environ["DAIYOUSEI_UNIX_SOCKET"] = socket_name
+		try:
+			os.unlink(socket_name)
+		except:
+			pass
+		with run_client() as client:
+			self.assertEqual(255, client.wait())
+			self.assertTrue(b"No such file or directory" in client.stderr.read())
+	
+	def test_streams(self):
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			while len(consume(conn)) == 0:
+				pass
+			client.stdin.write(b"some input")
+			client.stdin.close()
+			request = receive_all(conn)
+			conn.send(b"l6:stdout6:output6:stderr5:error8:exitcodei66ee")
+			self.assertEqual(b"5:stdin10:some inpute", request)
+			self.assertEqual(b"output", client.stdout.read())
+			self.assertEqual(b"error", client.stderr.read())
+			self.assertEqual(66, client.wait())
+	
+	def test_regular_file(self):
+		data = os.urandom(1024 * 1024)
+		with open("./target/stdin.bin", "wb") as file:
+			file.write(data)
+		try:
+			with open("./target/stdin.bin", "rb") as file, setup() as server, run_client(stdin = file) as client, server.accept()[0] as conn:
+				request = receive_all(conn)
+				conn.send(b"l8:exitcodei0ee")
+				self.assertEqual(0, client.wait())
+				self.assertEqual(data, stdin_of(request))
+		finally:
+			os.unlink("./target/stdin.bin")
+	
+	def test_large_stdin_slow_server(self):
+		data = os.urandom(8 * 1024 * 1024)
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			def produce():
+				client.stdin.write(data)
+				client.stdin.close()
+			producer = Thread(target = produce)
+			producer.start()
+			time.sleep(0.5)
+			request = receive_all(conn)
+			producer.join()
+			conn.send(b"l8:exitcodei0ee")
+			self.assertEqual(0, client.wait())
+			self.assertEqual(data, stdin_of(request))
+	
+	def test_large_stdout_slow_reader(self):
+		data = os.urandom(8 * 1024 * 1024)
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			while len(consume(conn)) == 0:
+				pass
+			def produce():
+				conn.sendall(b"l")
+				for i in range(0, len(data), 65536):
+					conn.sendall(b"6:stdout65536:" + data[i : i + 65536])
+				conn.sendall(b"8:exitcodei0ee")
+			producer = Thread(target = produce)
+			producer.start()
+			time.sleep(0.5)
+			stdout = client.stdout.read()
+			producer.join()
+			self.assertEqual(0, client.wait())
+			self.assertEqual(data, stdout)
+	
+	def test_trailing_data(self):
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			while len(consume(conn)) == 0:
+				pass
+			conn.send(b"l8:exitcodei0ee5:extra")
+			self.assertEqual(255, client.wait())
+			self.assertTrue(b"key 'extra' is not valid" in client.stderr.read())
+
+class Test_Transports(unittest.TestCase):
+	def tearDown(self):
+		del os.environ["DAIYOUSEI_SOCKET"]
+	
+	def listen(self, family, type, address):
+		server = socket.socket(family, type)
+		server.bind(address)
+		server.listen(True)
+		return server
+	
+	def exchange(self, server):
+		with run_client() as client, server.accept()[0] as conn:
+			while len(consume(conn)) == 0:
+				pass
+			client.stdin.write(b"input")
+			client.stdin.close()
+			request = receive_all(conn)
+			conn.send(b"l6:stdout6:output8:exitcodei0ee")
+			self.assertEqual(b"5:stdin5:inpute", request)
+			self.assertEqual(b"output", client.stdout.read())
+			self.assertEqual(0, client.wait())
+	
+	def test_unix(self):
+		try:
+			os.unlink(socket_name)
+		except:
+			pass
+		os.environ["DAIYOUSEI_SOCKET"] = "unix:" + socket_name
+		with self.listen(socket.AF_UNIX, socket.SOCK_STREAM, socket_name) as server:
+			self.exchange(server)
+	
+	def test_unix_abstract(self):
+		os.environ["DAIYOUSEI_SOCKET"] = "unix-abstract:daiyousei-test-{}".format(os.getpid())
+		with self.listen(socket.AF_UNIX, socket.SOCK_STREAM, "\0daiyousei-test-{}".format(os.getpid())) as server:
+			self.exchange(server)
+	
+	def test_tcp(self):
+		with self.listen(socket.AF_INET, socket.SOCK_STREAM, ("127.0.0.1", 0)) as server:
+			os.environ["DAIYOUSEI_SOCKET"] = "tcp:127.0.0.1:{}".format(server.getsockname()[1])
+			self.exchange(server)
+	
+	def test_tcp_ignores_fd_passing(self):
+		os.environ["DAIYOUSEI_PASS_FDS"] = "2000"
+		try:
+			with self.listen(socket.AF_INET, socket.SOCK_STREAM, ("127.0.0.1", 0)) as server:
+				os.environ["DAIYOUSEI_SOCKET"] = "tcp:127.0.0.1:{}".format(server.getsockname()[1])
+				self.exchange(server)
+		finally:
+			del os.environ["DAIYOUSEI_PASS_FDS"]
+	
+	def test_tcp_refused(self):
+		with self.listen(socket.AF_INET, socket.SOCK_STREAM, ("127.0.0.1", 0)) as server:
+			port = server.getsockname()[1]
+		os.environ["DAIYOUSEI_SOCKET"] = "tcp:127.0.0.1:{}".format(port)
+		with run_client() as client:
+			self.assertEqual(255, client.wait())
+			self.assertTrue(b"Connection refused" in client.stderr.read())
+	
+	def test_unix_seqpacket(self):
+		try:
+			os.unlink(socket_name)
+		except:
+			pass
+		os.environ["DAIYOUSEI_SOCKET"] = "unix-seqpacket:" + socket_name
+		data = bytes(i % 251 for i in range(100000))
+		with self.listen(socket.AF_UNIX, socket.SOCK_SEQPACKET, socket_name) as server, run_client() as client, server.accept()[0] as conn:
+			preamble = conn.recv(1 << 20)
+			self.assertTrue(preamble.startswith(b"l"))
+			client.stdin.write(data)
+			client.stdin.close()
+			stdin = bytes()
+			while True:
+				message = conn.recv(1 << 20)
+				if message == b"e":
+					break
+				key, end = decode(message)
+				payload, end = decode(message, end)
+				self.assertEqual((b"stdin", len(message)), (key, end))
+				stdin += payload
+			self.assertEqual(data, stdin)
+			# a message longer than a page and several messages which may be read at once
+			conn.send(b"l6:stdout100000:" + data)
+			for i in range(100):
+				conn.send(b"6:stdout1:x")
+			conn.send(b"8:exitcodei0ee")
+			self.assertEqual(data + b"x" * 100, client.stdout.read())
+			self.assertEqual(0, client.wait())
+	
+	def test_invalid(self):
+		os.environ["DAIYOUSEI_SOCKET"] = "carrier-pigeon:home"
+		with run_client() as client:
+			self.assertEqual(255, client.wait())
+			self.assertTrue(b"carrier-pigeon" in client.stderr.read())
+
+class Test_Connect(unittest.TestCase):
+	def tearDown(self):
+		os.environ.pop("DAIYOUSEI_CONNECT_TIMEOUT", None)
+	
+	def fill_backlog(self, server):
+		connections = []
+		while True:
+			connection = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+			connection.setblocking(False)
+			try:
+				connection.connect(socket_name)
+			except BlockingIOError:
+				connection.close()
+				return connections
+			connections.append(connection)
+	
+	def test_backlog_full(self):
+		os.environ["DAIYOUSEI_STATISTICS"] = "1"
+		try:
+			with setup() as server:
+				server.listen(0)
+				connections = self.fill_backlog(server)
+				with run_client() as client:
+					time.sleep(0.3)
+					for connection in connections:
+						server.accept()[0].close()
+						connection.close()
+					with server.accept()[0] as conn:
+						while len(consume(conn)) == 0:
+							pass
+						conn.send(b"l8:exitcodei0ee")
+						self.assertEqual(0, client.wait())
+						stderr = client.stderr.read()
+						if b"backend: epoll" in stderr:
+							self.assertLess(0, int(re.search(rb"connect retries: (\d+)", stderr)[1]))
+		finally:
+			del os.environ["DAIYOUSEI_STATISTICS"]
+	
+	def test_backlog_full_timeout(self):
+		os.environ["DAIYOUSEI_CONNECT_TIMEOUT"] = "200"
+		with setup() as server:
+			server.listen(0)
+			connections = self.fill_backlog(server)
+			start = time.monotonic()
+			with run_client() as client:
+				self.assertEqual(255, client.wait())
+				self.assertLess(time.monotonic() - start, 5)
+				self.assertTrue(b"failed to connect" in client.stderr.read())
+			for connection in connections:
+				connection.close()
+	
+	def test_invalid_timeout(self):
+		os.environ["DAIYOUSEI_CONNECT_TIMEOUT"] = "0"
+		with setup() as server, run_client() as client:
+			self.assertEqual(255, client.wait())
+			self.assertTrue(b"DAIYOUSEI_CONNECT_TIMEOUT" in client.stderr.read())
+
+class Test_Autostart(unittest.TestCase):
+	socket_name = "./target/autostart.sock"
+	log_name = "./target/autostart.log"
+	
+	# exits once no client has connected for a second
+	server = """
+import os, socket, sys
+if os.environ["LISTEN_FDS"] != "1" or os.environ["LISTEN_PID"] != str(os.getpid()):
+	sys.exit(1)
+with open(sys.argv[1], "a") as log:
+	log.write("started\\n")
+server = socket.socket(fileno = 3)
+server.settimeout(1)
+try:
+	while True:
+		with server.accept()[0] as conn:
+			conn.recv(65536)
+			conn.sendall(b"l6:stdout7:started8:exitcodei0ee")
+except TimeoutError:
+	pass
+"""
+	
+	def setUp(self):
+		for name in [self.socket_name, self.socket_name + ".lock", self.log_name]:
+			try:
+				os.unlink(name)
+			except FileNotFoundError:
+				pass
+		os.environ["DAIYOUSEI_UNIX_SOCKET"] = self.socket_name
+		os.environ["DAIYOUSEI_SERVER_COMMAND"] = "exec {} -c '{}' {}".format(sys.executable, self.server, self.log_name)
+	
+	def tearDown(self):
+		os.environ["DAIYOUSEI_UNIX_SOCKET"] = socket_name
+		del os.environ["DAIYOUSEI_SERVER_COMMAND"]
+		os.environ.pop("DAIYOUSEI_CONNECT_TIMEOUT", None)
+	
+	def starts(self):
+		with open(self.log_name) as log:
+			return len(log.readlines())
+	
+	def test_concurrent_clients(self):
+		clients = [run_client() for i in range(20)]
+		for client in clients:
+			with client:
+				self.assertEqual(b"started", client.stdout.read())
+				self.assertEqual(0, client.wait())
+		self.assertEqual(1, self.starts())
+	
+	def test_running_server(self):
+		with run_client() as client:
+			self.assertEqual(0, client.wait())
+		with run_client() as client:
+			self.assertEqual(b"started", client.stdout.read())
+			self.assertEqual(0, client.wait())
+		self.assertEqual(1, self.starts())
+	
+	def test_stale_socket(self):
+		with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as stale:
+			stale.bind(self.socket_name)
+		with run_client() as client:
+			self.assertEqual(b"started", client.stdout.read())
+			self.assertEqual(0, client.wait())
+		self.assertEqual(1, self.starts())
+	
+	def test_failing_command(self):
+		os.environ["DAIYOUSEI_SERVER_COMMAND"] = "exit 1"
+		with run_client() as client:
+			self.assertEqual(255, client.wait())
+	
+	def test_lock_held_until_timeout(self):
+		os.environ["DAIYOUSEI_CONNECT_TIMEOUT"] = "200"
+		with open(self.socket_name + ".lock", "w") as lock:
+			fcntl.flock(lock, fcntl.LOCK_EX)
+			start = time.monotonic()
+			with run_client() as client:
+				self.assertEqual(255, client.wait())
+				self.assertLess(time.monotonic() - start, 5)
+				self.assertTrue(b"timed out waiting for the lock" in client.stderr.read())
+		self.assertFalse(os.path.exists(self.log_name))
+
+class Test_Batch(unittest.TestCase):
+	def setUp(self):
+		os.environ["DAIYOUSEI_BATCH"] = "1"
+	
+	def tearDown(self):
+		del os.environ["DAIYOUSEI_BATCH"]
+	
+	def command(self, argv, **keys):
+		result = b"d4:argvl" + b"".join(str(len(arg)).encode() + b":" + arg for arg in argv) + b"e"
+		for key, value in sorted(keys.items()):
+			result += str(len(key)).encode() + b":" + key.encode() + str(len(value)).encode() + b":" + value
+		return result + b"e"
+	
+	def results(self, data):
+		results = []
+		pos = 0
+		while pos != len(data):
+			result, pos = decode(data, pos)
+			results.append(result)
+		return results
+	
+	def respond(self, conn, request, acknowledge):
+		"""
+		Echoes the arguments to the standard output and the standard input to the standard error output,
+		the exit code is the number of arguments
+		"""
+		argv = request[1]
+		stdin = b"".join(request[i + 1] for i in range(6, len(request), 2) if request[i] == b"stdin")
+		response = b"l12:capabilitiesl5:batche" if acknowledge else b"l"
+		response += b"6:stdout" + str(len(b" ".join(argv))).encode() + b":" + b" ".join(argv)
+		response += b"6:stderr" + str(len(stdin)).encode() + b":" + stdin
+		conn.sendall(response + b"8:exitcodei" + str(len(argv)).encode() + b"ee")
+	
+	def test_single_connection(self):
+		with open("./target/stdin.bin", "wb") as file:
+			file.write(b"some input")
+		try:
+			with setup() as server, run_client() as client:
+				client.stdin.write(self.command([b"first"]) + self.command([b"second", b"a"], stdin = b"./target/stdin.bin")
+					+ self.command([b"third", b"b", b"c"], cwd = b"target"))
+				client.stdin.close()
+				requests = []
+				with server.accept()[0] as conn:
+					data = bytes()
+					for i in range(3):
+						request, data = receive_request(conn, data)
+						requests.append(request)
+						self.respond(conn, request, i == 0)
+					self.assertEqual(b"", receive_all(conn))
+				self.assertEqual(0, client.wait())
+				self.assertEqual([
+					{b"exitcode": 1, b"stdout": b"first", b"stderr": b""},
+					{b"exitcode": 2, b"stdout": b"second a", b"stderr": b"some input"},
+					{b"exitcode": 3, b"stdout": b"third b c", b"stderr": b""},
+				], self.results(client.stdout.read()))
+				self.assertIn(b"batch", requests[0][7])
+				self.assertNotIn(b"capabilities", requests[1])
+				self.assertEqual(os.path.abspath("target").encode(), requests[2][3])
+				self.assertEqual(requests[0][5], requests[2][5])
+		finally:
+			os.unlink("./target/stdin.bin")
+	
+	def test_not_acknowledged(self):
+		with setup() as server, run_client() as client:
+			client.stdin.write(self.command([b"first"]) + self.command([b"second"]))
+			client.stdin.close()
+			for i in range(2):
+				with server.accept()[0] as conn:
+					request, _ = receive_request(conn, bytes())
+					self.assertIn(b"batch", request[7])
+					self.respond(conn, request, False)
+			self.assertEqual(0, client.wait())
+			self.assertEqual([b"first", b"second"], [result[b"stdout"] for result in self.results(client.stdout.read())])
+	
+	def test_invalid_command(self):
+		with setup() as server, run_client() as client:
+			client.stdin.write(b"d3:fooi1ee")
+			client.stdin.close()
+			self.assertEqual(255, client.wait())
+			self.assertIn(b"key 'foo' of a command is not valid", client.stderr.read())
+	
+	def test_incomplete_command(self):
+		with setup() as server, run_client() as client:
+			client.stdin.write(b"d4:argvl")
+			client.stdin.close()
+			self.assertEqual(255, client.wait())
+			self.assertIn(b"incomplete command", client.stderr.read())
+	
+	def test_key_without_value(self):
+		with setup() as server, run_client() as client:
+			client.stdin.write(b"d4:argvl1:ae3:cwde")
+			client.stdin.close()
+			self.assertEqual(255, client.wait())
+			self.assertIn(b"key 'cwd' of a command has no value", client.stderr.read())
+
+class Test_Cache(unittest.TestCase):
+	cache_directory = "./target/cache"
+	
+	def setUp(self):
+		shutil.rmtree(self.cache_directory, ignore_errors = True)
+		os.environ["DAIYOUSEI_CACHE"] = self.cache_directory
+	
+	def tearDown(self):
+		for name in ["DAIYOUSEI_CACHE", "DAIYOUSEI_CACHE_COMMANDS", "DAIYOUSEI_CACHE_ENV", "CACHE_TEST_VARIABLE", "DAIYOUSEI_SOCKET"]:
+			os.environ.pop(name, None)
+		shutil.rmtree(self.cache_directory, ignore_errors = True)
+	
+	def run_served(self, stdin, response):
+		"""
+		@return The exit code, the standard output, the standard error output and the request
+		"""
+		with setup() as server, run_client() as client:
+			client.stdin.write(stdin)
+			client.stdin.close()
+			with server.accept()[0] as conn:
+				request, _ = receive_request(conn, bytes())
+				conn.sendall(response)
+			return client.wait(), client.stdout.read(), client.stderr.read(), request
+	
+	def run_unserved(self, stdin):
+		"""
+		Runs the client without a server listening
+		@return The exit code, the standard output and the standard error output
+		"""
+		try:
+			os.unlink(socket_name)
+		except FileNotFoundError:
+			pass
+		result = subprocess.run(["./target/bin/daiyousei"], input = stdin, capture_output = True)
+		return result.returncode, result.stdout, result.stderr
+	
+	def test_listed_command(self):
+		os.environ["DAIYOUSEI_CACHE_COMMANDS"] = "other,daiyousei"
+		response = b"l6:stdout3:out6:stderr3:err6:stdout4:put28:exitcodei3ee"
+		exitcode, stdout, stderr, request = self.run_served(b"input", response)
+		self.assertEqual((3, b"output2", b"err"), (exitcode, stdout, stderr))
+		self.assertEqual(b"input", b"".join(request[i + 1] for i in range(8, len(request), 2) if request[i] == b"stdin"))
+		self.assertEqual((3, b"output2", b"err"), self.run_unserved(b"input"))
+		self.assertEqual(255, self.run_unserved(b"other input")[0])
+	
+	def test_not_listed_command(self):
+		os.environ["DAIYOUSEI_CACHE_COMMANDS"] = "other"
+		exitcode, _, _, request = self.run_served(b"input", b"l8:exitcodei0ee")
+		self.assertEqual(0, exitcode)
+		self.assertNotIn(b"cache", request[7])
+		self.assertFalse(os.path.exists(self.cache_directory))
+	
+	def test_marked_by_server(self):
+		exitcode, stdout, _, request = self.run_served(b"marked", b"l12:capabilitiesl5:cachee6:stdout2:ok5:cachei1e8:exitcodei0ee")
+		self.assertEqual((0, b"ok"), (exitcode, stdout))
+		self.assertIn(b"cache", request[7])
+		self.assertEqual((0, b"ok", b""), self.run_unserved(b"marked"))
+		exitcode, _, _, _ = self.run_served(b"unmarked", b"l12:capabilitiesl5:cachee6:stdout2:ok8:exitcodei0ee")
+		self.assertEqual(0, exitcode)
+		self.assertEqual(255, self.run_unserved(b"unmarked")[0])
+	
+	def test_cache_key_not_acknowledged(self):
+		exitcode, _, stderr, _ = self.run_served(b"", b"l5:cachei1e8:exitcodei0ee")
+		self.assertEqual(255, exitcode)
+		self.assertIn(b"key 'cache' is not valid", stderr)
+	
+	def test_environment_in_key(self):
+		os.environ["DAIYOUSEI_CACHE_COMMANDS"] = "daiyousei"
+		os.environ["DAIYOUSEI_CACHE_ENV"] = "CACHE_TEST_VARIABLE"
+		os.environ["CACHE_TEST_VARIABLE"] = "first"
+		self.assertEqual(0, self.run_served(b"", b"l6:stdout5:first8:exitcodei0ee")[0])
+		os.environ["CACHE_TEST_VARIABLE"] = "second"
+		self.assertEqual(255, self.run_unserved(b"")[0])
+		os.environ["CACHE_TEST_VARIABLE"] = "first"
+		self.assertEqual((0, b"first", b""), self.run_unserved(b""))
+	
+	def test_transport_in_key(self):
+		os.environ["DAIYOUSEI_CACHE_COMMANDS"] = "daiyousei"
+		self.assertEqual(0, self.run_served(b"", b"l6:stdout2:ok8:exitcodei0ee")[0])
+		os.environ["DAIYOUSEI_SOCKET"] = "unix:./target/other.sock"
+		self.assertEqual(255, self.run_unserved(b"")[0])
+		del os.environ["DAIYOUSEI_SOCKET"]
+		self.assertEqual((0, b"ok", b""), self.run_unserved(b""))
+	
+	def test_entry_of_another_request(self):
+		os.environ["DAIYOUSEI_CACHE_COMMANDS"] = "daiyousei"
+		self.assertEqual(0, self.run_served(b"input", b"l6:stdout2:ok8:exitcodei0ee")[0])
+		entries = os.listdir(self.cache_directory)
+		self.assertEqual(1, len(entries))
+		# a colliding key is simulated by changing the stored standard input
+		with open(os.path.join(self.cache_directory, entries[0]), "r+b") as entry:
+			data = entry.read()
+			entry.seek(data.index(b"input"))
+			entry.write(b"other")
+		self.assertEqual(255, self.run_unserved(b"input")[0])
+	
+	def test_regular_file_stdin(self):
+		os.environ["DAIYOUSEI_CACHE_COMMANDS"] = "daiyousei"
+		with open("./target/stdin.bin", "wb") as file:
+			file.write(b"x" * 300000)
+		try:
+			with setup() as server, open("./target/stdin.bin", "rb") as stdin, run_client(stdin = stdin) as client:
+				with server.accept()[0] as conn:
+					request, _ = receive_request(conn, bytes())
+					conn.sendall(b"l6:stdout4:file8:exitcodei0ee")
+				self.assertEqual(0, client.wait())
+			with open("./target/stdin.bin", "rb") as stdin:
+				os.unlink(socket_name)
+				result = subprocess.run(["./target/bin/daiyousei"], stdin = stdin, capture_output = True)
+				self.assertEqual((0, b"file"), (result.returncode, result.stdout))
+		finally:
+			os.unlink("./target/stdin.bin")
+	
+	def test_malformed_entry(self):
+		os.environ["DAIYOUSEI_CACHE_COMMANDS"] = "daiyousei"
+		self.assertEqual(0, self.run_served(b"", b"l6:stdout2:ok8:exitcodei0ee")[0])
+		entries = os.listdir(self.cache_directory)
+		self.assertEqual(1, len(entries))
+		with open(os.path.join(self.cache_directory, entries[0]), "r+b") as entry:
+			entry.truncate(8)
+		self.assertEqual(255, self.run_unserved(b"")[0])
+
+def fnv128(data):
+	result = 0x6c62272e07bb0142_62b821756295c58d
+	for byte in data:
+		result = ((result ^ byte) * (2 ** 88 + 0x13b)) % 2 ** 128
+	return "{:032x}".format(result).encode()
+
+class Test_Digests(unittest.TestCase):
+	def run_client(self, environment):
+		return subprocess.Popen(["./target/bin/daiyousei", "-c", "command"],
+			stdin = subprocess.PIPE,
+			stdout = subprocess.PIPE,
+			stderr = subprocess.PIPE,
+			env = {name: value for name, value in dict({"DAIYOUSEI_UNIX_SOCKET": socket_name, "DAIYOUSEI_DIGESTS": "2000", "DAIYOUSEI_ARGV_PREFIX": "2"}, **environment).items() if value is not None},
+		)
+	
+	def receive_digests(self, conn):
+		"""
+		@return The offered digests and the data following them
+		"""
+		data = bytes()
+		while True:
+			chunk = conn.recv(65536)
+			if len(chunk) == 0:
+				raise EOFError("connection closed")
+			data += chunk
+			try:
+				key, end = decode(data, 1)
+				digests, end = decode(data, end)
+				self.assertEqual(b"digests", key)
+				return digests, data[end:]
+			except (IndexError, ValueError):
+				pass
+	
+	def receive_rest(self, conn, client, data):
+		client.stdin.close()
+		request, _ = decode(b"l" + data + receive_all(conn))
+		return request
+	
+	def test_stable_digests(self):
+		environment = {"FIRST": "1", "SECOND": "2"}
+		expected_env = b"l"
+		for name, value in sorted(dict(environment, DAIYOUSEI_UNIX_SOCKET = socket_name, DAIYOUSEI_DIGESTS = "2000", DAIYOUSEI_ARGV_PREFIX = "2").items()):
+			expected_env += "{}:{}{}:{}".format(len(name), name, len(value), value).encode()
+		expected_env += b"e"
+		for order in [environment, dict(reversed(environment.items()))]:
+			with setup() as server, self.run_client(order) as client, server.accept()[0] as conn:
+				digests, _ = self.receive_digests(conn)
+				conn.send(b"l7:digestsle8:exitcodei0ee")
+				self.assertEqual(0, client.wait())
+				self.assertEqual({b"argv": fnv128(b"l22:./target/bin/daiyousei2:-ce"), b"env": fnv128(expected_env)}, digests)
+	
+	def test_known(self):
+		with setup() as server, self.run_client({"NAME": "value"}) as client, server.accept()[0] as conn:
+			_, data = self.receive_digests(conn)
+			conn.send(b"l7:digestsl4:argv3:enve")
+			request = self.receive_rest(conn, client, data)
+			conn.send(b"6:stdout2:ok8:exitcodei0ee")
+			self.assertEqual([b"argv", [b"command"], b"cwd"], request[:3])
+			self.assertNotIn(b"env", request[3::2])
+			self.assertEqual(b"ok", client.stdout.read())
+			self.assertEqual(0, client.wait())
+	
+	def test_unknown(self):
+		with setup() as server, self.run_client({"NAME": "value"}) as client, server.accept()[0] as conn:
+			_, data = self.receive_digests(conn)
+			conn.send(b"l7:digestsl4:argve")
+			request = self.receive_rest(conn, client, data)
+			conn.send(b"8:exitcodei0ee")
+			self.assertEqual([b"argv", [b"command"], b"cwd"], request[:3])
+			self.assertEqual(b"env", request[4])
+			self.assertIn(b"value", request[5])
+			self.assertEqual(0, client.wait())
+	
+	def test_old_server(self):
+		with setup() as server, self.run_client({"NAME": "value", "DAIYOUSEI_DIGESTS": "100"}) as client, server.accept()[0] as conn:
+			_, data = self.receive_digests(conn)
+			request = self.receive_rest(conn, client, data)
+			conn.send(b"l8:exitcodei0ee")
+			self.assertEqual([b"argv", [b"./target/bin/daiyousei", b"-c", b"command"], b"cwd"], request[:3])
+			self.assertEqual(b"env", request[4])
+			self.assertEqual(0, client.wait())
+	
+	def test_not_offered(self):
+		with setup() as server, self.run_client({"DAIYOUSEI_ARGV_PREFIX": None}) as client, server.accept()[0] as conn:
+			digests, _ = self.receive_digests(conn)
+			self.assertEqual([b"env"], list(digests))
+			conn.send(b"l7:digestsl4:argve")
+			self.assertEqual(255, client.wait())
+			self.assertIn(b"digest 'argv' was not offered", client.stderr.read())
+
+class Test_Fast_exit(unittest.TestCase):
+	def setUp(self):
+		os.environ["DAIYOUSEI_FAST_EXIT"] = "1"
+	
+	def tearDown(self):
+		del os.environ["DAIYOUSEI_FAST_EXIT"]
+	
+	def test_end_of_list_not_awaited(self):
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			# the standard input stays open, the client ends the request itself
+			conn.send(b"l6:stdout6:output8:exitcodei3e")
+			self.assertEqual(3, client.wait(timeout = 5))
+			self.assertEqual(b"output", client.stdout.read())
+			self.assertTrue(receive_all(conn).endswith(b"e"))
+			client.stdin.close()
+	
+	def test_large_output_flushed(self):
+		data = b"x" * 3000000
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			client.stdin.close()
+			def serve():
+				conn.sendall(b"l" + b"".join(b"6:stdout" + str(len(chunk)).encode() + b":" + chunk for chunk in [data[i : i + 500000] for i in range(0, len(data), 500000)]) + b"8:exitcodei0e")
+			server_thread = Thread(target = serve)
+			server_thread.start()
+			self.assertEqual(data, client.stdout.read())
+			server_thread.join()
+			self.assertEqual(0, client.wait(timeout = 5))
+	
+	def test_violation_after_exit_code(self):
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			client.stdin.close()
+			conn.send(b"l8:exitcodei0e5:extra")
+			self.assertEqual(255, client.wait(timeout = 5))
+			self.assertIn(b"key 'extra' is not valid", client.stderr.read())
+	
+	def test_batch_waits(self):
+		with setup() as server:
+			def serve():
+				with server.accept()[0] as conn:
+					data = bytes()
+					for i in range(2):
+						_, data = receive_request(conn, data)
+						conn.send((b"l12:capabilitiesl5:batche" if i == 0 else b"l") + b"8:exitcodei" + str(i).encode() + b"e")
+						time.sleep(0.1)
+						conn.send(b"e")
+			server_thread = Thread(target = serve)
+			server_thread.start()
+			result = subprocess.run(["./target/bin/daiyousei"], input = b"d4:argvl4:trueeed4:argvl5:falseee", capture_output = True,
+				env = dict(os.environ, DAIYOUSEI_BATCH = "1"))
+			server_thread.join()
+			self.assertEqual(0, result.returncode)
+			self.assertEqual(b"d8:exitcodei0e6:stderr0:6:stdout0:ed8:exitcodei1e6:stderr0:6:stdout0:e", result.stdout)
+
+class Test_Trace(unittest.TestCase):
+	trace_name = "target/trace.jsonl"
+	
+	def setUp(self):
+		try:
+			os.unlink(self.trace_name)
+		except FileNotFoundError:
+			pass
+		os.environ["DAIYOUSEI_TRACE"] = self.trace_name
+	
+	def tearDown(self):
+		del os.environ["DAIYOUSEI_TRACE"]
+	
+	def read_traces(self):
+		with open(self.trace_name) as trace:
+			return [json.loads(line) for line in trace]
+	
+	def test_phases(self):
+		response = b"l6:stdout6:output8:exitcodei3ee"
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			client.stdin.close()
+			_, rest = receive_request(conn, bytes())
+			time.sleep(0.05)
+			conn.send(response[:-1])
+			time.sleep(0.05)
+			conn.send(b"e")
+			self.assertEqual(3, client.wait(timeout = 5))
+			self.assertEqual(b"", rest + receive_all(conn))
+		[trace] = self.read_traces()
+		self.assertEqual(client.pid, trace["pid"])
+		self.assertEqual("./target/bin/daiyousei", trace["program"])
+		self.assertEqual(3, trace["exitcode"])
+		self.assertGreater(trace["bytes_sent"], 0)
+		# the header and the end of the standard input
+		self.assertEqual(2, trace["sends"])
+		self.assertEqual(len(response), trace["bytes_received"])
+		self.assertGreaterEqual(trace["receive_calls"], 2)
+		self.assertLessEqual(trace["peak_buffer"], len(response))
+		phases = [trace[name] for name in ["connect_us", "request_sent_us", "first_byte_us", "exit_code_us", "end_of_list_us", "finished_us"]]
+		self.assertEqual(sorted(phases), phases)
+		# the server waited 50 ms before each part of the response,
+		# the client may take its timestamps slightly after the server starts waiting
+		self.assertGreaterEqual(trace["first_byte_us"] - trace["request_sent_us"], 40000)
+		self.assertGreaterEqual(trace["end_of_list_us"] - trace["exit_code_us"], 40000)
+	
+	def test_failure_traced(self):
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			client.stdin.close()
+			conn.send(b"l5:extrai1ee")
+			self.assertEqual(255, client.wait(timeout = 5))
+		[trace] = self.read_traces()
+		self.assertIsNone(trace["exitcode"])
+		self.assertIsNone(trace["exit_code_us"])
+		self.assertIsNone(trace["end_of_list_us"])
+		self.assertIsNotNone(trace["finished_us"])
+	
+	def test_lines_appended(self):
+		for exitcode in range(3):
+			with setup() as server, run_client() as client, server.accept()[0] as conn:
+				client.stdin.close()
+				conn.send(b"l8:exitcodei" + str(exitcode).encode() + b"ee")
+				self.assertEqual(exitcode, client.wait(timeout = 5))
+		self.assertEqual([0, 1, 2], [trace["exitcode"] for trace in self.read_traces()])
+	
+	def test_file_descriptor(self):
+		read_end, write_end = os.pipe()
+		with setup() as server, open(read_end, "rb") as reader:
+			with open(write_end, "wb") as writer, subprocess.Popen(["./target/bin/daiyousei"], stdin = subprocess.PIPE, stdout = subprocess.PIPE,
+				stderr = subprocess.PIPE, pass_fds = [write_end], env = dict(os.environ, DAIYOUSEI_TRACE = "fd:" + str(write_end))) as client:
+				with server.accept()[0] as conn:
+					client.stdin.close()
+					conn.send(b"l8:exitcodei0ee")
+					self.assertEqual(0, client.wait(timeout = 5))
+			trace = json.loads(reader.read())
+		self.assertEqual(0, trace["exitcode"])
+		self.assertFalse(os.path.exists(self.trace_name))
+
+class Test_Stats(unittest.TestCase):
+	stats_name = "target/stats"
+	
+	def setUp(self):
+		try:
+			os.unlink(self.stats_name)
+		except FileNotFoundError:
+			pass
+		os.environ["DAIYOUSEI_STATS_FILE"] = self.stats_name
+	
+	def tearDown(self):
+		del os.environ["DAIYOUSEI_STATS_FILE"]
+	
+	def run_tool(self, *arguments):
+		return subprocess.run(["./target/bin/daiyousei-stats", *arguments], capture_output = True, check = True).stdout.decode()
+	
+	def test_invocations_aggregated(self):
+		for response in [b"l6:stdout6:output8:exitcodei0ee"] * 3 + [b"l5:extrai1ee"]:
+			with setup() as server, run_client() as client, server.accept()[0] as conn:
+				client.stdin.close()
+				receive_request(conn, bytes())
+				conn.send(response)
+				client.wait(timeout = 5)
+		rows = {row[3]: row for row in (line.split() for line in self.run_tool().splitlines()[1:])}
+		self.assertEqual(["connect_us", "first_byte_us", "total_us", "bytes_sent", "bytes_received"], list(rows.keys()))
+		self.assertEqual(["daiyousei", "4", "1", "total_us", "4"], rows["total_us"][:5])
+		# the buckets of the sizes are exact below 4 and a quarter wide above
+		p50, p90, p99, mean = map(int, rows["bytes_received"][5:])
+		self.assertTrue(31 <= p50 <= 31 * 5 // 4, rows["bytes_received"])
+		# the invalid response is counted too
+		self.assertEqual((3 * 31 + 12) // 4, mean)
+		prometheus = self.run_tool("--prometheus")
+		self.assertIn('daiyousei_invocations_total{program="daiyousei"} 4\n', prometheus)
+		self.assertIn('daiyousei_failures_total{program="daiyousei"} 1\n', prometheus)
+		self.assertIn('daiyousei_total_us_count{program="daiyousei"} 4\n', prometheus)
+		self.assertIn('daiyousei_bytes_received_bucket{program="daiyousei",le="+Inf"} 4\n', prometheus)
+	
+	def test_concurrent_clients(self):
+		count = 20
+		with setup() as server:
+			clients = [run_client(stdin = subprocess.DEVNULL) for i in range(count)]
+			for i in range(count):
+				with server.accept()[0] as conn:
+					receive_request(conn, bytes())
+					conn.send(b"l8:exitcodei0ee")
+			for client in clients:
+				self.assertEqual(0, client.wait(timeout = 5))
+				client.stdout.close()
+				client.stderr.close()
+		self.assertIn('daiyousei_invocations_total{program="daiyousei"} ' + str(count) + "\n", self.run_tool("--prometheus"))
+	
+	def test_other_file_untouched(self):
+		with open(self.stats_name, "wb") as other:
+			other.write(b"other data")
+		with setup() as server, run_client() as client, server.accept()[0] as conn:
+			client.stdin.close()
+			conn.send(b"l8:exitcodei0ee")
+			self.assertEqual(0, client.wait(timeout = 5))
+		with open(self.stats_name, "rb") as other:
+			self.assertEqual(b"other data", other.read())
+		result = subprocess.run(["./target/bin/daiyousei-stats"], capture_output = True)
+		self.assertEqual(1, result.returncode)
+		self.assertIn(b"not a statistics file", result.stderr)
+
 try:
 	unittest.main()
 finally:
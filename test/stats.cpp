@@ -0,0 +1,93 @@
+#include <stats.hpp>
+#include <testing.hpp>
+
+#include <unistd.h>
+
+#include <thread>
+#include <vector>
+
+std::initializer_list<testing::Test_case> testing::test_cases
+{
+Test_case("bucket bounds", []
+{
+	for (std::size_t i = 0; i != stats::bucket_count; ++i)
+	{
+		testing::assert_eq(i, stats::bucket_index(stats::bucket_lower_bound(i)));
+		testing::assert_eq(i, stats::bucket_index(stats::bucket_upper_bound(i)));
+	}
+	
+	for (std::uint64_t value = 0; value != 100'000; ++value)
+	{
+		auto index = stats::bucket_index(value);
+		testing::assert_true(stats::bucket_lower_bound(index) <= value and value <= stats::bucket_upper_bound(index));
+		// the upper bound is at most a quarter above the value
+		testing::assert_true(stats::bucket_upper_bound(index) <= value + value / 4);
+	}
+	
+	testing::assert_eq(stats::bucket_count - 1, stats::bucket_index(std::uint64_t(1) << 40));
+	testing::assert_eq(stats::bucket_count - 1, stats::bucket_index(std::uint64_t(-1)));
+}),
+
+Test_case("quantiles", []
+{
+	auto histogram = stats::Histogram();
+	
+	for (std::uint64_t value = 1; value <= 100; ++value)
+	{
+		++histogram.count_;
+		++histogram.buckets_[stats::bucket_index(value)];
+	}
+	
+	testing::assert_eq(std::uint64_t(55), histogram.quantile(0.5));
+	testing::assert_eq(std::uint64_t(95), histogram.quantile(0.9));
+	testing::assert_eq(std::uint64_t(111), histogram.quantile(0.99));
+	testing::assert_eq(std::uint64_t(0), stats::Histogram().quantile(0.5));
+}),
+
+Test_case("concurrent records", []
+{
+	auto path = std::string("target/test_stats.") + std::to_string(getpid());
+	unlink(path.c_str());
+	
+	auto values = std::array<std::optional<std::uint64_t>, stats::metric_names.size()>();
+	values[std::size_t(stats::Metric::total)] = 1000;
+	auto threads = std::vector<std::thread>();
+	
+	for (std::size_t i = 0; i != 8; ++i)
+	{
+		threads.emplace_back([&path, &values, i]() -> void
+		{
+			for (std::size_t j = 0; j != 1000; ++j)
+			{
+				stats::record(path.c_str(), i % 2 == 0 ? "even" : "odd", j == 0, values);
+			}
+		});
+	}
+	
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+	
+	auto file = stats::map(path.c_str(), false);
+	unlink(path.c_str());
+	testing::assert_true(file.get() != nullptr);
+	
+	for (auto name : {"even", "odd"})
+	{
+		auto program = stats::find(*file.get(), name, false);
+		testing::assert_true(program != nullptr);
+		testing::assert_eq(std::string_view(name), program->name());
+		testing::assert_eq(std::uint64_t(4000), program->invocations_);
+		testing::assert_eq(std::uint64_t(4), program->failures_);
+		testing::assert_eq(std::uint64_t(0), program->histograms_[std::size_t(stats::Metric::connect)].count_);
+		
+		const auto& total = program->histograms_[std::size_t(stats::Metric::total)];
+		testing::assert_eq(std::uint64_t(4000), total.count_);
+		testing::assert_eq(std::uint64_t(4'000'000), total.sum_);
+		testing::assert_eq(std::uint32_t(4000), total.buckets_[stats::bucket_index(1000)]);
+	}
+	
+	testing::assert_true(stats::find(*file.get(), "other", false) == nullptr);
+}),
+};